@@ -2,341 +2,860 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <map>
-#include <set>
+#include <deque>
 #include <vector>
-#include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <stdexcept>
 #include <iomanip>         // For std::fixed, std::setprecision
+#include <thread>
+#include <exception>
+#include <cstdlib>
+#include <climits>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "csvstream.hpp"   // Must be in the same directory
+#include "csvmmap.hpp"
+#include "work_queue.hpp"
+#include "output_buffer.hpp"
+#include "classifier.hpp"
 
 using namespace std;
 
-/*
- * Return a set of unique, whitespace-delimited words from a string.
- * Fulfills the "bag of words" model by ignoring duplicates.
- */
-set<string> unique_words(const string &text) {
-    istringstream iss(text);
-    set<string> words;
-    string w;
-    while (iss >> w) {
-        words.insert(w);
-    }
-    return words;
+// Write the top candidates of a prediction, one per line
+static void report_candidates(ostream &os, const vector<Classifier::Candidate> &top) {
+    for (size_t i = 0; i < top.size(); ++i) {
+        os << "  top " << i + 1 << " = " << top[i].label
+           << ", log-probability score = ";
+        print_mixed_precision(top[i].log_score, os);
+        os << ", probability = ";
+        print_mixed_precision(top[i].probability, os);
+        os << "\n";
+    }
 }
 
-/*
- * Helper function that:
- *   1) If |x| < 1, uses 3 decimals
- *   2) Else if 1 <= |x| < 10, uses 2 decimals
- *   3) Otherwise (|x| >= 10), uses 1 decimal
- *   4) Then removes trailing zeroes (e.g. "-13.70" -> "-13.7", "2.00" -> "2").
- */
-static void print_mixed_precision(double x) {
-    // Save current format
-    ios init(nullptr);
-    init.copyfmt(cout);
-
-    // Step A: Convert to string with the chosen precision
-    double ax = fabs(x);
-    ostringstream oss;
-    if (ax < 1.0) {
-        oss << fixed << setprecision(3) << x;
-    }
-    else if (ax < 10.0) {
-        oss << fixed << setprecision(2) << x;
+// Predict one test post and write its report, including the top candidates
+// if top > 0.  Returns true if the prediction is correct.
+static bool report_prediction(ostream &os, const Classifier &nb, string_view true_label,
+                              string_view content, size_t top) {
+    const vector<string_view> &words = unique_words(content);
+    vector<Classifier::Candidate> candidates;
+    pair<string, double> prediction;
+    if (top > 0) candidates = nb.predict_topk(words, top);
+    if (!candidates.empty()) {
+        prediction = {candidates.front().label, candidates.front().log_score};
     }
     else {
-        oss << fixed << setprecision(1) << x;
+        prediction = nb.predict(words);
     }
-    string s = oss.str();
+    auto &[predicted_label, log_prob_score] = prediction;
+
+    // Print the required output for each test post
+    os << "  correct = " << true_label
+       << ", predicted = " << predicted_label
+       << ", log-probability score = ";
+    print_mixed_precision(log_prob_score, os);
+    os << "\n";
+    report_candidates(os, candidates);
+
+    os << "  content = " << content << "\n\n";
+
+    return predicted_label == true_label;
+}
 
-    // Step B: Strip trailing zeros. e.g. "1.10" -> "1.1"
-    while (!s.empty() && s.back() == '0') {
-        s.pop_back();
+// Test posts handed from the reader stage to the prediction workers, and
+// their formatted reports on the way to the writer stage
+struct TestBatch {
+    size_t seq = 0;
+    vector<string> labels;
+    vector<string> contents;
+    string output;
+    int correct = 0;
+};
+
+// Number of test posts per batch
+const size_t BATCH_SIZE = 256;
+
+// Reports of scored batches, released to the writer in input order
+class BatchReorder {
+public:
+    // A worker finished a batch
+    void done(TestBatch batch) {
+        lock_guard<mutex> lock(m);
+        finished.emplace(batch.seq, std::move(batch));
+        cv.notify_all();
     }
 
-    // Step C: If it ends with '.', remove it too
-    if (!s.empty() && s.back() == '.') {
-        s.pop_back();
+    // The reader will not produce more than total batches
+    void end(size_t total) {
+        lock_guard<mutex> lock(m);
+        total_batches = total;
+        cv.notify_all();
     }
 
-    // Print the result
-    cout << s;
+    // Wait for the next batch in input order.  Returns false after the last.
+    bool next(TestBatch &batch) {
+        unique_lock<mutex> lock(m);
+        cv.wait(lock, [&] {
+            return finished.count(next_seq) || next_seq == total_batches;
+        });
+        if (next_seq == total_batches) return false;
+        batch = std::move(finished.at(next_seq));
+        finished.erase(next_seq++);
+        return true;
+    }
 
-    // Restore old format
-    cout.copyfmt(init);
-}
+private:
+    mutex m;
+    condition_variable cv;
+    map<size_t, TestBatch> finished;
+    size_t next_seq = 0;
+    size_t total_batches = SIZE_MAX;
+};
 
-/*
- * A simple Bernoulli Naive Bayes Classifier for the EECS 280 project.
- * Stores counts and vocabulary derived from a training set of (label, content) pairs.
- * Then can predict labels for new posts.
- */
-class Classifier {
-public:
-    // Train the classifier on a CSV input stream (with columns "tag" and "content").
-    // If print_training_data == true, prints line-by-line info of each training post.
-    void train(csvstream &csvin, bool print_training_data = false) {
-        map<string, string> row;
-        while (csvin >> row) {
-            const string &label   = row.at("tag");
-            const string &content = row.at("content");
-
-            if (print_training_data) {
-                // Print line-by-line training data (train-only mode)
-                cout << "  label = " << label
-                     << ", content = " << content << "\n";
-            }
+// Reader stage: cut the test file into batches.  Returns the batch count.
+static size_t read_batches(csvmmap &test_csv, work_queue<TestBatch> &todo) {
+    csvrow_view row;
+    TestBatch batch;
+    size_t seq = 0;
+    while (read_post(test_csv, row)) {
+        batch.labels.emplace_back(row[TAG]);
+        batch.contents.emplace_back(row[CONTENT]);
+        if (batch.labels.size() == BATCH_SIZE) {
+            batch.seq = seq++;
+            todo.push(std::move(batch));
+            batch = TestBatch();
+        }
+    }
+    if (!batch.labels.empty()) {
+        batch.seq = seq++;
+        todo.push(std::move(batch));
+    }
+    return seq;
+}
 
-            ++total_posts;
-            label_counts[label]++;
+// Predict every post of a test file, writing reports to cout in input order.
+// With threads > 1, a reader thread, a pool of prediction workers sharing the
+// read-only model, and the calling thread as writer run as a pipeline.
+// Returns {#correct, #posts}.
+static pair<int, int> predict_file(const Classifier &nb, csvmmap &test_csv,
+                                   size_t threads, size_t top) {
+    run_stats::scoped_timer timer(PREDICT_TIME);
+    int correct_count = 0;
+    int total_test_posts = 0;
+    if (threads <= 1) {
+        csvrow_view row;
+        while (read_post(test_csv, row)) {
+            ++total_test_posts;
+            correct_count += report_prediction(cout, nb, row[TAG], row[CONTENT], top);
+        }
+        return {correct_count, total_test_posts};
+    }
 
-            // Extract unique words in this post
-            set<string> words_in_post = unique_words(content);
-            for (const auto &w : words_in_post) {
-                vocabulary.insert(w);
-                ++word_counts[w];               // total #posts containing w (all labels)
-                ++label_word_counts[label][w];  // #posts w/ this label containing w
-            }
+    work_queue<TestBatch> todo(2 * threads);
+    BatchReorder reorder;
+    exception_ptr error;
+    thread reader([&]() {
+        size_t total = 0;
+        try {
+            total = read_batches(test_csv, todo);
         }
+        catch (...) {
+            error = current_exception();
+        }
+        todo.close();
+        reorder.end(total);
+    });
+
+    vector<thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&]() {
+            TestBatch batch;
+            while (todo.pop(batch)) {
+                ostringstream os;
+                for (size_t j = 0; j < batch.labels.size(); ++j) {
+                    batch.correct += report_prediction(os, nb, batch.labels[j],
+                                                       batch.contents[j], top);
+                }
+                batch.output = os.str();
+                reorder.done(std::move(batch));
+            }
+        });
     }
 
-    // Print training summary.
-    // - Always prints "trained on X examples"
-    // - If train_only_mode == true, also prints vocabulary size, label details, and word likelihoods
-    void print_training_summary(bool train_only_mode) const {
-        // 1) total number of examples
-        cout << "trained on " << total_posts << " examples\n";
+    TestBatch batch;
+    while (reorder.next(batch)) {
+        cout << batch.output;
+        correct_count += batch.correct;
+        total_test_posts += static_cast<int>(batch.labels.size());
+    }
+    reader.join();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    if (error) rethrow_exception(error);
+    return {correct_count, total_test_posts};
+}
 
-        // 2) If "train-only" mode, print the rest
-        if (train_only_mode) {
-            cout << "vocabulary size = " << vocabulary.size() << "\n\n";
+// Set by SIGINT/SIGTERM to shut a server down
+static atomic<bool> stop_serving(false);
 
-            // Print label info in alphabetical order
-            cout << "classes:\n";
-            vector<string> sorted_labels;
-            for (auto &lc : label_counts) {
-                sorted_labels.push_back(lc.first);
-            }
-            sort(sorted_labels.begin(), sorted_labels.end());
-
-            // For each label, print count and log-prior
-            for (auto &lbl : sorted_labels) {
-                double prior = double(label_counts.at(lbl)) / double(total_posts);
-                double log_prior = log(prior);
-
-                cout << "  " << lbl << ", "
-                     << label_counts.at(lbl) << " examples, "
-                     << "log-prior = ";
-                print_mixed_precision(log_prior);
-                cout << "\n";
-            }
+extern "C" void request_stop(int) {
+    stop_serving = true;
+}
 
-            // Print classifier parameters
-            cout << "classifier parameters:\n";
-            for (auto &lbl : sorted_labels) {
-                // Gather words used by this label
-                vector<string> words_for_label;
-                for (auto &wcount : label_word_counts.at(lbl)) {
-                    words_for_label.push_back(wcount.first);
-                }
-                sort(words_for_label.begin(), words_for_label.end());
-
-                for (auto &w : words_for_label) {
-                    int count_label_word = label_word_counts.at(lbl).at(w);
-                    double numerator   = double(count_label_word);
-                    double denominator = double(label_counts.at(lbl));
-                    // log( (#posts label & word) / (#posts label) )
-                    double ll = log(numerator / denominator);
-
-                    cout << "  " << lbl << ":" << w
-                         << ", count = " << count_label_word
-                         << ", log-likelihood = ";
-                    print_mixed_precision(ll);
-                    cout << "\n";
-                }
+// Latencies of answered server requests, reported at shutdown
+class LatencyLog {
+public:
+    // n requests were answered after the given time
+    void add(double seconds, size_t n) {
+        lock_guard<mutex> lock(m);
+        latencies.insert(latencies.end(), n, seconds);
+    }
+
+    // Print request count and latency percentiles in microseconds
+    void report(ostream &os) {
+        lock_guard<mutex> lock(m);
+        os << "served " << latencies.size() << " requests";
+        if (!latencies.empty()) {
+            sort(latencies.begin(), latencies.end());
+            const pair<const char *, double> points[] = {
+                {"p50", 0.50}, {"p90", 0.90}, {"p99", 0.99}, {"max", 1.0}};
+            for (const auto &point : points) {
+                size_t i = size_t(point.second * double(latencies.size() - 1));
+                os << ", " << point.first << " = "
+                   << setprecision(1) << fixed << latencies[i] * 1e6 << " us";
             }
-            cout << "\n";
         }
+        os << endl;
+    }
+
+private:
+    mutex m;
+    vector<double> latencies;
+};
+
+// Wait until fd has data or the server is stopping.  Returns false to stop.
+static bool wait_readable(int fd) {
+    pollfd p = {fd, POLLIN, 0};
+    while (!stop_serving) {
+        int ready = poll(&p, 1, 200);
+        if (ready > 0) return true;
+        if (ready < 0 && errno != EINTR) return false;
     }
+    return false;
+}
 
-    // Predict a label for a new post. Returns {best_label, best_log_score}.
-    pair<string, double> predict(const set<string> &post_words) const {
-        // We’ll find label that maximizes:
-        //    log(#posts w/ label / total_posts) + sum( log(P(w|label)) for w in post_words )
-        // Summation is done in alphabetical order for consistency.
+static bool write_all(int fd, const string &data) {
+    for (size_t done = 0; done < data.size(); ) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += size_t(n);
+    }
+    return true;
+}
 
-        // Convert set -> sorted vector
-        vector<string> sorted_post_words(post_words.begin(), post_words.end());
-        sort(sorted_post_words.begin(), sorted_post_words.end());
+// Answer one post with "label\tscore", or with top > 0, the top candidates
+// as "label\tscore\tprobability" joined by tabs
+static void answer(ostream &os, const Classifier &nb, string_view post, size_t top) {
+    if (!post.empty() && post.back() == '\r') post.remove_suffix(1);
+    if (top == 0) {
+        auto [label, score] = nb.predict(unique_words(post));
+        os << label << '\t';
+        print_mixed_precision(score, os);
+        os << '\n';
+        return;
+    }
+    vector<Classifier::Candidate> candidates = nb.predict_topk(unique_words(post), top);
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        os << (i ? "\t" : "") << candidates[i].label << '\t';
+        print_mixed_precision(candidates[i].log_score, os);
+        os << '\t';
+        print_mixed_precision(candidates[i].probability, os);
+    }
+    os << '\n';
+}
 
-        // Sort labels to break ties by alphabetical order
-        vector<string> sorted_labels;
-        for (auto &lc : label_counts) {
-            sorted_labels.push_back(lc.first);
+// Answer newline-delimited posts read from in_fd, writing one response line
+// per post to out_fd.  All complete lines of one read() are answered with a
+// single write().
+static void serve_stream(const Classifier &nb, int in_fd, int out_fd,
+                         LatencyLog &log, size_t top) {
+    string pending;
+    vector<char> buffer(1 << 16);
+    bool open = true;
+    while (open) {
+        ssize_t n = wait_readable(in_fd) ? read(in_fd, buffer.data(), buffer.size()) : 0;
+        if (n < 0 && errno == EINTR) continue;
+        auto start = chrono::steady_clock::now();
+        open = n > 0;
+        pending.append(buffer.data(), open ? size_t(n) : 0);
+        if (!open && !pending.empty() && !stop_serving) pending += '\n';
+
+        ostringstream os;
+        size_t begin = 0;
+        size_t lines = 0;
+        for (size_t end; (end = pending.find('\n', begin)) != string::npos; begin = end + 1) {
+            answer(os, nb, string_view(pending).substr(begin, end - begin), top);
+            ++lines;
         }
-        sort(sorted_labels.begin(), sorted_labels.end());
+        pending.erase(0, begin);
+        if (lines == 0) continue;
+        open = write_all(out_fd, os.str()) && open;
+        log.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+                lines);
+    }
+}
 
-        string best_label;
-        double best_score = -numeric_limits<double>::infinity();
+// Listen on a Unix domain socket at path, replacing any stale socket file
+static int listen_unix(const string &path) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw runtime_error("Socket path too long: " + path);
+    }
+    path.copy(addr.sun_path, path.size());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (fd < 0 || ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        if (fd >= 0) close(fd);
+        throw runtime_error("Error listening on socket: " + path);
+    }
+    return fd;
+}
 
-        for (auto &lbl : sorted_labels) {
-            // Start with log-prior
-            double log_prior = log(double(label_counts.at(lbl)) / double(total_posts));
-            double score = log_prior;
+// Serve until SIGINT/SIGTERM, or end of input on stdin.  endpoint "-" reads
+// stdin and writes stdout; anything else is a Unix socket path.  Its
+// connections are served by a pool of threads threads, each serving one
+// connection at a time, and further connections wait for a free thread.
+// Posts on one connection are answered in order, one at a time.  Latency
+// percentiles go to stderr on shutdown.
+static void serve(const Classifier &nb, const string &endpoint, size_t threads,
+                  size_t top) {
+    signal(SIGINT, request_stop);
+    signal(SIGTERM, request_stop);
+    signal(SIGPIPE, SIG_IGN);
+
+    LatencyLog log;
+    if (endpoint == "-") {
+        serve_stream(nb, STDIN_FILENO, STDOUT_FILENO, log, top);
+    }
+    else {
+        int listener = listen_unix(endpoint);
+        work_queue<int> connections(threads);
+        vector<thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([&]() {
+                for (int fd; connections.pop(fd); ) {
+                    serve_stream(nb, fd, fd, log, top);
+                    close(fd);
+                }
+            });
+        }
+        while (wait_readable(listener)) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd >= 0 && !connections.push(fd)) close(fd);
+        }
+        connections.close();
+        close(listener);
+        unlink(endpoint.c_str());
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+    log.report(cerr);
+}
 
-            // Add log-likelihood contributions for each word
-            for (auto &w : sorted_post_words) {
-                score += word_log_likelihood(lbl, w);
-            }
+// Posts of a training file split into K folds for cross-validation.  The
+// views point into the mapped file, or into copies for a compressed file.
+struct Folds {
+    deque<string> copies;
+    vector<string_view> labels;
+    vector<string_view> contents;
+    vector<vector<size_t>> members; // posts of each fold, in file order
+    vector<string_view> label_set;  // every label, in alphabetical order
+};
 
-            // Check if this is the best so far (tie-break on alphabetical label)
-            if ((score > best_score) ||
-                (fabs(score - best_score) < 1e-14 && lbl < best_label)) {
-                best_score = score;
-                best_label = lbl;
+// Read every post and deal them out to k folds, label by label: with the
+// posts sorted stably by label, the j-th goes to fold j % k.  Each fold gets
+// its share of every label and fold sizes differ by at most one, however
+// the file is ordered.
+static Folds read_folds(csvmmap &csv, size_t k) {
+    Folds folds;
+    csvrow_view row;
+    while (read_post(csv, row)) {
+        if (!csv.in_memory()) {
+            for (PostColumn column : {TAG, CONTENT}) {
+                folds.copies.emplace_back(row[column]);
+                row.fields[column] = folds.copies.back();
             }
         }
-        return {best_label, best_score};
+        folds.labels.push_back(row[TAG]);
+        folds.contents.push_back(row[CONTENT]);
     }
+    vector<size_t> order(folds.labels.size());
+    iota(order.begin(), order.end(), size_t(0));
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return folds.labels[a] < folds.labels[b];
+    });
+    folds.members.resize(k);
+    for (size_t j = 0; j < order.size(); ++j) {
+        folds.members[j % k].push_back(order[j]);
+    }
+    for (auto &members : folds.members) {
+        sort(members.begin(), members.end());
+    }
+    folds.label_set = folds.labels;
+    sort(folds.label_set.begin(), folds.label_set.end());
+    folds.label_set.erase(unique(folds.label_set.begin(), folds.label_set.end()),
+                          folds.label_set.end());
+    return folds;
+}
 
-private:
-    int total_posts = 0;
-    set<string> vocabulary; // All unique words in training data
-
-    // label -> #posts with that label
-    map<string, int> label_counts;
-
-    // word -> #posts (across all labels) containing that word
-    map<string, int> word_counts;
-
-    // label -> (word -> #posts with label that contain word)
-    map<string, map<string, int>> label_word_counts;
-
-    /*
-     * Compute log P(word | label) according to the assignment spec.
-     * Cases:
-     *  1) If the word never appears anywhere: log(1 / (total_posts + 2))
-     *  2) If the word appears in the corpus but not under this label:
-     *     log(1 / (#posts with label + 2))
-     *  3) Otherwise: log( (# label&word) / (# label) )
-     */
-    double word_log_likelihood(const std::string &label, const std::string &word) const {
-        // "occurrences" = total # of posts containing this word
-        double occurrences = 0.0;
-        if (word_counts.find(word) != word_counts.end()) {
-            occurrences = static_cast<double>(word_counts.at(word));
-        }
-
-        // "candw" = # of posts that contain "word" AND have label "label",
-        // or -1 if none is recorded.
-        double candw = -1.0;
-        auto it_label = label_word_counts.find(label);
-        if (it_label != label_word_counts.end()) {
-            auto it_word = it_label->second.find(word);
-            if (it_word != it_label->second.end()) {
-                candw = static_cast<double>(it_word->second);
+// Results of one fold: a confusion matrix indexed by [correct][predicted]
+// position in Folds::label_set
+struct FoldResult {
+    size_t correct = 0;
+    size_t total = 0;
+    vector<vector<size_t>> confusion;
+};
+
+// Run body(f) for every fold f on up to threads threads
+template <typename Body>
+static void for_each_fold(size_t k, size_t threads, Body body) {
+    atomic<size_t> next(0);
+    vector<exception_ptr> errors(k);
+    auto work = [&]() {
+        for (size_t f; (f = next++) < k; ) {
+            try {
+                body(f);
+            }
+            catch (...) {
+                errors[f] = current_exception();
             }
         }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < min(threads, k); ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto &error : errors) {
+        if (error) rethrow_exception(error);
+    }
+}
+
+// Print a confusion matrix with a row per correct label and a column per
+// predicted label, both in alphabetical order
+static void print_confusion(const vector<string_view> &label_set,
+                            const vector<vector<size_t>> &confusion) {
+    size_t width = 1;
+    for (string_view label : label_set) width = max(width, label.size());
+    for (const auto &counts : confusion) {
+        for (size_t count : counts) width = max(width, to_string(count).size());
+    }
 
-        // CASE 1: candw == -1 AND occurrences == 0 => word never appears anywhere
-        if ((candw == -1.0) && (occurrences == 0.0)) {
-            // returns ln(1 / total_posts)
-            double hold = 1.0 / static_cast<double>(total_posts);
-            return std::log(hold);
+    cout << "confusion matrix (rows = correct, columns = predicted):\n"
+         << "  " << setw(int(width)) << "";
+    for (string_view label : label_set) {
+        cout << " " << setw(int(width)) << label;
+    }
+    cout << "\n";
+    for (size_t i = 0; i < label_set.size(); ++i) {
+        cout << "  " << left << setw(int(width)) << label_set[i] << right;
+        for (size_t count : confusion[i]) {
+            cout << " " << setw(int(width)) << count;
         }
+        cout << "\n";
+    }
+}
 
-        // CASE 2: candw == -1 AND occurrences != 0 => word appears globally, but not under this label
-        if ((candw == -1.0) && (occurrences != 0.0)) {
-            // returns ln(occurrences / total_posts)
-            double hold2 = occurrences / static_cast<double>(total_posts);
-            return std::log(hold2);
+// k-fold cross-validation of the training file: predict each fold with a
+// model of the other folds.  The folds are counted once; each fold's model
+// is their total with that fold subtracted, which predicts the same as
+// training on the other folds from scratch.  Folds run on up to threads
+// threads.  Words are hashed into 2^hash_bits buckets if hash_bits > 0.
+// Returns {#correct, #posts}.
+static pair<int, int> cross_validate(csvmmap &csv, size_t k, size_t threads,
+                                     unsigned hash_bits) {
+    Folds folds = read_folds(csv, k);
+    size_t n = folds.labels.size();
+    cout << "cross-validation: " << k << " folds of " << n << " posts\n";
+
+    // Count each fold, then add them up in order
+    vector<model_arena> arenas(k);
+    vector<Classifier> fold_counts;
+    for (auto &arena : arenas) {
+        fold_counts.emplace_back(&arena);
+        fold_counts.back().hash_words(hash_bits);
+    }
+    for_each_fold(k, threads, [&](size_t f) {
+        for (size_t i : folds.members[f]) {
+            fold_counts[f].add_post(folds.labels[i], folds.contents[i]);
         }
+    });
+    model_arena total_memory;
+    Classifier total(&total_memory);
+    total.hash_words(hash_bits);
+    for (const Classifier &counts : fold_counts) {
+        total.merge(counts);
+    }
 
-        // CASE 3: We have a valid candw => returns ln(#(label&word)/ #(label))
-        double cTotal = static_cast<double>(label_counts.at(label));
-        double hold3  = candw / cTotal;
-        return std::log(hold3);
+    vector<FoldResult> results(k);
+    for_each_fold(k, threads, [&](size_t f) {
+        size_t fold_size = folds.members[f].size();
+        if (fold_size == 0 || fold_size == n) {
+            return;     // Nothing to predict, or nothing to train on
+        }
+        model_arena memory;
+        Classifier nb(&memory);
+        nb.hash_words(hash_bits);
+        nb.merge(total);
+        nb.subtract(fold_counts[f]);
+        nb.compile();
+
+        FoldResult &result = results[f];
+        size_t labels = folds.label_set.size();
+        result.confusion.assign(labels, vector<size_t>(labels, 0));
+        auto position = [&](string_view label) {
+            return size_t(lower_bound(folds.label_set.begin(), folds.label_set.end(),
+                                      label) - folds.label_set.begin());
+        };
+        for (size_t i : folds.members[f]) {
+            string predicted = nb.predict(unique_words(folds.contents[i])).first;
+            ++result.confusion[position(folds.labels[i])][position(predicted)];
+            result.correct += predicted == folds.labels[i];
+            ++result.total;
+        }
+    });
+
+    size_t labels = folds.label_set.size();
+    vector<vector<size_t>> confusion(labels, vector<size_t>(labels, 0));
+    size_t correct = 0;
+    size_t total_posts = 0;
+    for (size_t f = 0; f < k; ++f) {
+        const FoldResult &result = results[f];
+        cout << "  fold " << f + 1 << ": " << result.correct << " / " << result.total
+             << " posts predicted correctly";
+        if (result.total > 0) {
+            cout << ", accuracy = " << double(result.correct) / double(result.total);
+        }
+        cout << "\n";
+        for (size_t i = 0; i < result.confusion.size(); ++i) {
+            for (size_t j = 0; j < labels; ++j) {
+                confusion[i][j] += result.confusion[i][j];
+            }
+        }
+        correct += result.correct;
+        total_posts += result.total;
     }
+    cout << "\n";
+    print_confusion(folds.label_set, confusion);
+    return {int(correct), int(total_posts)};
+}
+
+// Command line options
+struct Options {
+    size_t threads = 1;     // --threads N, also connections served at once
+    size_t top = 0;         // --top K, report the K best labels
+    string save_model;      // --save-model FILE
+    string load_model;      // --load-model FILE, replaces TRAIN_FILE
+    string serve;           // --serve - | --serve SOCKET, replaces TEST_FILE
+    string update;          // --update CSV, more training posts
+    size_t cross_validate = 0; // --cross-validate K, folds of TRAIN_FILE
+    size_t hash_bits = 0;   // --hash-bits K, hash words into 2^K buckets
+    size_t min_count = 0;   // --min-count N, drop words in fewer posts
+    size_t max_vocab = 0;   // --max-vocab M, keep the M most common words
+    bool stats = false;     // --stats, timing breakdown on stderr
+    bool stats_json = false; // --stats-json, the same as JSON on stderr
+    bool quantize = false;  // --quantize, find candidates in a 16-bit table
+    bool sparse = false;    // --sparse, score through an inverted index
+    string train_filename;
+    string test_filename;   // Empty in train-only mode
 };
 
+const char USAGE[] =
+    "Usage: classifier.exe [--threads N] [--save-model FILE] TRAIN_FILE [TEST_FILE]\n"
+    "       classifier.exe [--threads N] --load-model FILE [TEST_FILE]\n"
+    "       classifier.exe [--update CSV] [--save-model FILE] ...\n"
+    "       classifier.exe [--stats] [--stats-json] [--top K] [--hash-bits K] ...\n"
+    "       classifier.exe [--min-count N] [--max-vocab M] [--quantize] [--sparse] ...\n"
+    "       classifier.exe [--threads N] --serve -|SOCKET (TRAIN_FILE|--load-model FILE)\n"
+    "       classifier.exe [--threads N] --cross-validate K TRAIN_FILE";
+
+// Parse a positive count such as the N of "--threads N"
+static bool parse_count(const char *arg, size_t &count) {
+    char *end = nullptr;
+    unsigned long value = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || value == 0) return false;
+    count = value;
+    return true;
+}
+
+// Parse the command line described by USAGE.  Returns false on bad usage.
+static bool parse_options(int argc, char *argv[], Options &opts) {
+    int i = 1;
+    for (; i < argc && string(argv[i]).rfind("--", 0) == 0; i += 2) {
+        string flag = argv[i];
+        if (flag == "--stats" || flag == "--stats-json" || flag == "--quantize" ||
+            flag == "--sparse") {
+            (flag == "--stats" ? opts.stats :
+             flag == "--stats-json" ? opts.stats_json :
+             flag == "--quantize" ? opts.quantize : opts.sparse) = true;
+            --i;    // takes no value
+            continue;
+        }
+        if (i + 1 >= argc) return false;
+        if (flag == "--threads") {
+            if (!parse_count(argv[i + 1], opts.threads)) return false;
+        }
+        else if (flag == "--top") {
+            if (!parse_count(argv[i + 1], opts.top)) return false;
+        }
+        else if (flag == "--save-model") {
+            opts.save_model = argv[i + 1];
+        }
+        else if (flag == "--load-model") {
+            opts.load_model = argv[i + 1];
+        }
+        else if (flag == "--serve") {
+            opts.serve = argv[i + 1];
+        }
+        else if (flag == "--update") {
+            opts.update = argv[i + 1];
+        }
+        else if (flag == "--cross-validate") {
+            if (!parse_count(argv[i + 1], opts.cross_validate)) return false;
+            if (opts.cross_validate < 2) return false;
+        }
+        else if (flag == "--hash-bits") {
+            if (!parse_count(argv[i + 1], opts.hash_bits)) return false;
+            if (opts.hash_bits > Classifier::MAX_HASH_BITS) return false;
+        }
+        else if (flag == "--min-count") {
+            if (!parse_count(argv[i + 1], opts.min_count)) return false;
+            if (opts.min_count > size_t(INT_MAX)) return false;
+        }
+        else if (flag == "--max-vocab") {
+            if (!parse_count(argv[i + 1], opts.max_vocab)) return false;
+        }
+        else {
+            return false;
+        }
+    }
+
+    // A loaded model takes the place of TRAIN_FILE
+    int files = argc - i + (opts.load_model.empty() ? 0 : 1);
+    if (files < 1 || files > (opts.serve.empty() ? 2 : 1)) return false;
+    if (opts.load_model.empty()) opts.train_filename = argv[i++];
+    if (files == 2) opts.test_filename = argv[i];
+
+    // A loaded model keeps the hashing it was trained with, and hash
+    // buckets cannot be pruned
+    if (opts.hash_bits && !opts.load_model.empty()) return false;
+    bool prune = opts.min_count || opts.max_vocab;
+    if (prune && opts.hash_bits) return false;
+
+    // Cross-validation tests on TRAIN_FILE itself and keeps no model
+    if (opts.cross_validate) {
+        return files == 1 && opts.load_model.empty() && opts.serve.empty() &&
+               opts.update.empty() && opts.save_model.empty() && !prune;
+    }
+    return true;
+}
+
+// Posts whose predictions are timed before and after pruning, at most
+const size_t PRUNE_SAMPLE_POSTS = 1000;
+
+// Shortest time spent predicting the sample, repeating it as needed
+const double PRUNE_TIMING_SECONDS = 0.2;
+
+// Contents of the first PRUNE_SAMPLE_POSTS posts of filename
+static vector<string> sample_posts(const string &filename) {
+    csvmmap csv(filename, POST_COLUMNS);
+    vector<string> contents;
+    csvrow_view row;
+    while (contents.size() < PRUNE_SAMPLE_POSTS && csv >> row) {
+        contents.emplace_back(row[CONTENT]);
+    }
+    return contents;
+}
+
+// Posts nb predicts per second, one thread
+static double predictions_per_second(const Classifier &nb, const vector<string> &posts) {
+    using clock = chrono::steady_clock;
+    size_t predicted = 0;
+    auto start = clock::now();
+    double elapsed = 0.0;
+    do {
+        for (const string &post : posts) {
+            nb.predict(unique_words(post));
+        }
+        predicted += posts.size();
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < PRUNE_TIMING_SECONDS);
+    return double(predicted) / elapsed;
+}
+
+// Drop rare words as --min-count and --max-vocab ask, and report the
+// vocabulary, model size and prediction speed before and after on stderr.
+// Speed is measured on the first posts of TEST_FILE, or of TRAIN_FILE if
+// there is none; a loaded model with no test file reports sizes only.
+static void prune_model(Classifier &nb, const Options &opts) {
+    const string &sample_file =
+        opts.test_filename.empty() ? opts.train_filename : opts.test_filename;
+    vector<string> sample;
+    if (!sample_file.empty()) sample = sample_posts(sample_file);
+
+    size_t words = nb.vocabulary_size();
+    double megabytes = double(nb.model_bytes()) / 1e6;
+    double speed = sample.empty() ? 0.0 : predictions_per_second(nb, sample);
+    nb.prune(int(max<size_t>(opts.min_count, 1)), opts.max_vocab);
+
+    ostringstream report;
+    report << fixed << setprecision(1) << "pruned vocabulary from " << words
+           << " to " << nb.vocabulary_size() << " words, model from "
+           << megabytes << " MB to " << double(nb.model_bytes()) / 1e6 << " MB";
+    if (!sample.empty()) {
+        report << setprecision(0) << ", prediction from " << speed << " to "
+               << predictions_per_second(nb, sample) << " posts/s";
+    }
+    cerr << report.str() << endl;
+}
+
+// Build the model from TRAIN_FILE, or map it from --load-model, add the
+// posts of --update, prune it, and print the training summary (except when
+// serving, where stdout carries answers)
+static void train_or_load(Classifier &nb, const Options &opts, bool train_only_mode) {
+    bool print_data = train_only_mode &&
+        (opts.load_model.empty() || !opts.update.empty());
+    if (print_data) {
+        cout << "training data:\n";
+    }
+
+    if (!opts.load_model.empty()) {
+        nb.load(opts.load_model);
+    }
+    else {
+        csvmmap train_csv(opts.train_filename, POST_COLUMNS);
+        nb.train(train_csv, train_only_mode, opts.threads);
+    }
+
+    if (!opts.update.empty()) {
+        csvmmap update_csv(opts.update, POST_COLUMNS);
+        nb.update(update_csv, train_only_mode, opts.threads);
+    }
+
+    if (opts.min_count || opts.max_vocab) {
+        prune_model(nb, opts);
+    }
+
+    // Print training summary
+    if (opts.serve.empty()) {
+        nb.print_training_summary(train_only_mode);
+    }
+
+    if (!opts.save_model.empty()) {
+        nb.save(opts.save_model);
+    }
+}
+
 int main(int argc, char *argv[]) {
     // We'll keep a default "3 decimals" for everything else,
     // but specifically for logs, we use our new print_mixed_precision().
     cout.precision(3);
     cout << fixed;
 
+    // Reports are written to stdout in large blocks
+    output_buffer stdout_buffer(cout, STDOUT_FILENO);
+
     // 1) Command line check
-    if (argc < 2 || argc > 3) {
-        cout << "Usage: classifier.exe TRAIN_FILE [TEST_FILE]" << endl;
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        cout << USAGE << endl;
         return 1;
     }
 
-    string train_filename = argv[1];
-    bool has_test_file = (argc == 3);
+    bool has_test_file = !opts.test_filename.empty();
+    run_stats::enable(opts.stats || opts.stats_json);
 
     // 2) Attempt to open train file
     try {
-        csvstream train_csv(train_filename);
-
-        // 3) Create classifier, do training
-        Classifier nb;
-        bool train_only_mode = !has_test_file;  // If no test file, it's train-only
-        if (train_only_mode) {
-            cout << "training data:\n";
+        if (opts.cross_validate) {
+            csvmmap train_csv(opts.train_filename, POST_COLUMNS);
+            auto [correct_count, total_posts] =
+                cross_validate(train_csv, opts.cross_validate, opts.threads,
+                               unsigned(opts.hash_bits));
+            cout << "performance: " << correct_count << " / " << total_posts
+                 << " posts predicted correctly\n";
         }
-        nb.train(train_csv, train_only_mode);
-
-        // Print training summary
-        nb.print_training_summary(train_only_mode);
-
-        // 4) If there's a test file, open it and predict
-        if (has_test_file) {
-            string test_filename = argv[2];
-            csvstream test_csv(test_filename);
-
-            cout << "\ntest data:\n";
-
-            int correct_count = 0;
-            int total_test_posts = 0;
-            map<string, string> row;
-
-            while (test_csv >> row) {
-                ++total_test_posts;
-                const string &true_label = row.at("tag");
-                const string &content    = row.at("content");
+        else {
+            // 3) Create classifier, do training
+            // The model is freed in one shot when main returns
+            model_arena model_memory;
+            Classifier nb(&model_memory);
+            nb.hash_words(unsigned(opts.hash_bits));
+            nb.quantize(opts.quantize);
+            nb.index_words(opts.sparse);
+            bool train_only_mode = !has_test_file;  // If no test file, it's train-only
+            train_or_load(nb, opts, train_only_mode && opts.serve.empty());
+
+            if (!opts.serve.empty()) {
+                serve(nb, opts.serve, opts.threads, opts.top);
+            }
 
-                // Predict
-                set<string> words = unique_words(content);
-                auto [predicted_label, log_prob_score] = nb.predict(words);
+            // 4) If there's a test file, open it and predict
+            else if (has_test_file) {
+                csvmmap test_csv(opts.test_filename, POST_COLUMNS);
 
-                // Print the required output for each test post
-                cout << "  correct = " << true_label
-                     << ", predicted = " << predicted_label
-                     << ", log-probability score = ";
-                print_mixed_precision(log_prob_score);
-                cout << "\n";
+                cout << "\ntest data:\n";
 
-                cout << "  content = " << content << "\n\n";
+                auto [correct_count, total_test_posts] =
+                    predict_file(nb, test_csv, opts.threads, opts.top);
 
-                if (predicted_label == true_label) {
-                    ++correct_count;
-                }
+                // Finally, print performance summary
+                cout << "performance: " << correct_count << " / " << total_test_posts
+                     << " posts predicted correctly\n";
             }
-
-            // Finally, print performance summary
-            cout << "performance: " << correct_count << " / " << total_test_posts
-                 << " posts predicted correctly\n";
         }
     }
-    catch (const csvstream_exception &) {
-        cerr << "Error opening file: "
-             << (has_test_file ? argv[2] : argv[1]) << endl;
+    catch (const csvstream_exception &e) {
+        // The message names the file at fault
+        cerr << e.what() << endl;
+        return 1;
+    }
+    catch (const runtime_error &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    catch (const logic_error &e) {
+        // Asked of a model that cannot do it, such as pruning a loaded
+        // model whose words were hashed
+        cerr << e.what() << endl;
         return 1;
     }
 
+    // Statistics go to stderr, so stdout stays the same
+    if (opts.stats || opts.stats_json) {
+        cout.flush();
+        if (opts.stats) run_stats::print(cerr);
+        if (opts.stats_json) run_stats::print_json(cerr);
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,1373 @@
+#ifndef CLASSIFIER_HPP
+#define CLASSIFIER_HPP
+/* classifier.hpp
+ *
+ * Bernoulli Naive Bayes model for classifying posts: training, model files
+ * and prediction.  Shared by the classifier program and its benchmark.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <charconv>
+#include <limits>
+#include <thread>
+#include <memory>
+#include <memory_resource>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include "csvmmap.hpp"
+#include "interner.hpp"
+#include "mapped_vector.hpp"
+#include "model_file.hpp"
+#include "model_arena.hpp"
+#include "tokenizer.hpp"
+#include "run_stats.hpp"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// The only CSV columns the classifier reads, in projected-row order
+const std::vector<std::string> POST_COLUMNS = {"tag", "content"};
+enum PostColumn { TAG, CONTENT };
+
+/*
+ * Return the unique, whitespace-delimited words of a string, in sorted order.
+ * Fulfills the "bag of words" model by ignoring duplicates.  The views point
+ * into text and are valid until the calling thread's next call.
+ */
+inline const std::vector<std::string_view> & unique_words(std::string_view text) {
+    run_stats::scoped_timer timer(TOKENIZE_TIME);
+    thread_local tokenizer words;
+    const std::vector<std::string_view> &unique = words.unique_words(text);
+    run_stats::count(WORDS_TOKENIZED, words.token_count());
+    run_stats::count(LOOKUPS_AVOIDED, words.token_count() - unique.size());
+    return unique;
+}
+
+/*
+ * Read the next post of a CSV file projected onto POST_COLUMNS into row.
+ * Returns false at the end of the file.
+ */
+inline bool read_post(csvmmap &csvin, csvrow_view &row) {
+    run_stats::scoped_timer timer(PARSE_TIME);
+    if (!(csvin >> row)) return false;
+    run_stats::count(ROWS_PARSED);
+    run_stats::count(BYTES_READ, row[TAG].size() + row[CONTENT].size());
+    return true;
+}
+
+/*
+ * Format x for output into buf, which must hold MIXED_PRECISION_MAX chars,
+ * and return the end of the text:
+ *   1) If 0.1 <= |x| < 1, uses 3 decimals
+ *   2) Else if 1 <= |x| < 10, uses 2 decimals
+ *   3) Else if 10 <= |x| < 100, uses 1 decimal
+ *   4) Then removes trailing zeroes (e.g. "-13.70" -> "-13.7", "2.00" -> "2").
+ *   5) Outside [0.1, 100), uses 3 significant digits ("-0.0306", "-162",
+ *      "-1.37e+03"), matching the reference .out.correct files.
+ * std::to_chars rounds exactly like printf, so the text is the same as the
+ * iostream formatting this replaces.
+ */
+const size_t MIXED_PRECISION_MAX = 32;
+
+inline char * format_mixed_precision(double x, char *buf) {
+    char *last = buf + MIXED_PRECISION_MAX;
+    double ax = std::fabs(x);
+    if (ax < 0.1 || ax >= 100.0) {
+        // General format already drops trailing zeroes
+        return std::to_chars(buf, last, x, std::chars_format::general, 3).ptr;
+    }
+    int decimals = ax < 1.0 ? 3 : ax < 10.0 ? 2 : 1;
+    char *end = std::to_chars(buf, last, x, std::chars_format::fixed, decimals).ptr;
+
+    // Strip trailing zeros, then a trailing '.'. e.g. "1.10" -> "1.1"
+    while (end > buf && end[-1] == '0') --end;
+    if (end > buf && end[-1] == '.') --end;
+    return end;
+}
+
+inline void print_mixed_precision(double x, std::ostream &os = std::cout) {
+    run_stats::scoped_timer timer(FORMAT_TIME);
+    char buf[MIXED_PRECISION_MAX];
+    os.write(buf, format_mixed_precision(x, buf) - buf);
+}
+
+/*
+ * Add n doubles from row into acc, adding fallback instead for cells that
+ * are NaN, and count the other cells in seen, two lanes at a time where
+ * the CPU has 128-bit vectors.  n must be even.
+ */
+inline void add_row(double *acc, double *seen, const double *row, double fallback,
+                    size_t n) {
+#if defined(__SSE2__)
+    __m128d other = _mm_set1_pd(fallback);
+    __m128d one = _mm_set1_pd(1.0);
+    for (size_t i = 0; i < n; i += 2) {
+        __m128d r = _mm_loadu_pd(row + i);
+        __m128d nan = _mm_cmpunord_pd(r, r);
+        r = _mm_or_pd(_mm_and_pd(nan, other), _mm_andnot_pd(nan, r));
+        _mm_storeu_pd(acc + i, _mm_add_pd(_mm_loadu_pd(acc + i), r));
+        __m128d number = _mm_andnot_pd(nan, one);
+        _mm_storeu_pd(seen + i, _mm_add_pd(_mm_loadu_pd(seen + i), number));
+    }
+#elif defined(__aarch64__)
+    float64x2_t other = vdupq_n_f64(fallback);
+    float64x2_t one = vdupq_n_f64(1.0);
+    float64x2_t zero = vdupq_n_f64(0.0);
+    for (size_t i = 0; i < n; i += 2) {
+        float64x2_t r = vld1q_f64(row + i);
+        uint64x2_t number = vceqq_f64(r, r);
+        r = vbslq_f64(number, r, other);
+        vst1q_f64(acc + i, vaddq_f64(vld1q_f64(acc + i), r));
+        vst1q_f64(seen + i, vaddq_f64(vld1q_f64(seen + i), vbslq_f64(number, one, zero)));
+    }
+#else
+    for (size_t i = 0; i < n; ++i) {
+        bool number = !std::isnan(row[i]);
+        acc[i] += number ? row[i] : fallback;
+        seen[i] += number;
+    }
+#endif
+}
+
+/*
+ * Add n 16-bit integers from row into 32-bit acc, eight lanes at a time
+ * where the CPU has 128-bit vectors.  n must be a multiple of 8.
+ */
+inline void add_row(int32_t *acc, const int16_t *row, size_t n) {
+#if defined(__SSE2__)
+    for (size_t i = 0; i < n; i += 8) {
+        __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        __m128i sign = _mm_srai_epi16(r, 15);
+        __m128i *lo = reinterpret_cast<__m128i *>(acc + i);
+        __m128i *hi = reinterpret_cast<__m128i *>(acc + i + 4);
+        __m128i low = _mm_unpacklo_epi16(r, sign);
+        __m128i high = _mm_unpackhi_epi16(r, sign);
+        _mm_storeu_si128(lo, _mm_add_epi32(_mm_loadu_si128(lo), low));
+        _mm_storeu_si128(hi, _mm_add_epi32(_mm_loadu_si128(hi), high));
+    }
+#elif defined(__aarch64__)
+    for (size_t i = 0; i < n; i += 8) {
+        int16x8_t r = vld1q_s16(row + i);
+        vst1q_s32(acc + i, vaddw_s16(vld1q_s32(acc + i), vget_low_s16(r)));
+        vst1q_s32(acc + i + 4, vaddw_s16(vld1q_s32(acc + i + 4), vget_high_s16(r)));
+    }
+#else
+    for (size_t i = 0; i < n; ++i) {
+        acc[i] += row[i];
+    }
+#endif
+}
+
+/*
+ * Scoring kernel for a compiled table exactly Columns doubles wide.  With
+ * the width a compile-time constant, the additions for each word unroll
+ * into straight-line code and the running scores stay in registers, where
+ * the add_row() loop loads and stores them again for every word.  Each
+ * score is added up in the same order, so the results are the same.
+ */
+template <size_t Columns>
+struct Scorer {
+    // scores[c] = priors[c] + row_of(0)[c] + ... + row_of(n - 1)[c], where
+    // row_of(i, fallback) also sets the value of the row's NaN cells, and
+    // seen[c] = the number of those rows whose cell c is not NaN
+    template <typename RowOf>
+    static void score(const double *priors, size_t n, RowOf &&row_of,
+                      double *scores, double *seen) {
+        double acc[Columns];
+        double count[Columns] = {};
+        std::copy(priors, priors + Columns, acc);
+        for (size_t i = 0; i < n; ++i) {
+            double fallback;
+            const double *row = row_of(i, fallback);
+            add(acc, count, row, fallback, std::make_index_sequence<Columns>());
+        }
+        std::copy(acc, acc + Columns, scores);
+        std::copy(count, count + Columns, seen);
+    }
+
+private:
+    template <size_t... C>
+    static void add(double *acc, double *count, const double *row, double fallback,
+                    std::index_sequence<C...>) {
+        ((acc[C] += std::isnan(row[C]) ? fallback : row[C],
+          count[C] += !std::isnan(row[C])), ...);
+    }
+};
+
+/*
+ * A simple Bernoulli Naive Bayes Classifier for the EECS 280 project.
+ * Stores counts and vocabulary derived from a training set of (label, content) pairs.
+ * Then can predict labels for new posts.
+ */
+class Classifier {
+public:
+    // Counts and compiled tables are allocated from memory, such as a
+    // model_arena that keeps all of the model's arrays in a few blocks.
+    explicit Classifier(
+        std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+        : memory(memory), vocabulary(memory), labels(memory),
+          label_counts(memory), word_counts(memory), label_word_counts(memory),
+          sorted_labels(memory), log_priors(memory), log_label_counts(memory),
+          unseen_word(memory),
+          log_occurrences(memory), table_blocks(memory), quantized_unseen(memory),
+          quantized_likelihoods(memory), quantized_offset(memory),
+          quantized_step(memory), quantized_error(memory),
+          posting_begin(memory), posting_col(memory), posting_value(memory) {}
+
+    // Train the classifier on a mapped CSV file projected onto POST_COLUMNS.
+    // If print_training_data == true, prints line-by-line info of each training post.
+    // With threads > 1, the file is split into one shard per thread at record
+    // boundaries.  Each shard is counted into its own tables, and the tables
+    // are merged in file order, so the model and all output are the same for
+    // any number of threads.
+    void train(csvmmap &csvin, bool print_training_data = false, size_t threads = 1) {
+        add_posts(csvin, print_training_data, threads);
+        compile();
+    }
+
+    // Add the posts of another CSV file to an already trained model, in
+    // place.  The counts end up the same as training on all files at once.
+    // Counting costs only as much as the new posts; refresh() then
+    // recomputes just the compiled values whose inputs changed.
+    void update(csvmmap &csvin, bool print_training_data = false, size_t threads = 1) {
+        add_posts(csvin, print_training_data, threads);
+        refresh();
+    }
+
+    // Count the posts of a CSV file into this model, splitting the work over
+    // threads as described for train().  A compressed file is read as it is
+    // decompressed and counted on one thread.
+    void add_posts(csvmmap &csvin, bool print_training_data, size_t threads) {
+        run_stats::scoped_timer timer(TRAIN_TIME);
+        if (threads <= 1 || !csvin.in_memory()) {
+            count_posts(csvin, print_training_data ? &std::cout : nullptr);
+            return;
+        }
+
+        // Shard tables are temporary, so each lives in its own arena
+        auto shards = csvin.split(threads);
+        std::vector<model_arena> arenas(shards.size());
+        std::vector<Classifier> parts;
+        for (auto &arena : arenas) {
+            parts.emplace_back(&arena);
+            parts.back().hash_words(hash_bits);
+        }
+        std::vector<std::ostringstream> printed(shards.size());
+        std::vector<std::exception_ptr> errors(shards.size());
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < shards.size(); ++i) {
+            workers.emplace_back([&, i]() {
+                try {
+                    parts[i].count_posts(*shards[i],
+                                         print_training_data ? &printed[i] : nullptr);
+                }
+                catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (errors[i]) std::rethrow_exception(errors[i]);
+            std::cout << printed[i].str();
+            merge(parts[i]);
+        }
+    }
+
+    // Add the counts of another model.  Labels and words new to this model
+    // get IDs in the other model's ID order, so merging shards in file order
+    // assigns the same IDs as counting the whole file at once.
+    void merge(const Classifier &other) {
+        check_hashing(other);
+        total_posts += other.total_posts;
+
+        std::vector<uint32_t> word_ids(other.num_words());
+        for (uint32_t w = 0; w < word_ids.size(); ++w) {
+            word_ids[w] = hash_bits ? w : intern_word(other.vocabulary.str(w));
+            word_counts[word_ids[w]] += other.word_counts[w];
+            changed_words[word_ids[w]] = true;
+        }
+
+        for (uint32_t l = 0; l < other.labels.size(); ++l) {
+            uint32_t id = intern_label(other.labels.str(l));
+            label_counts[id] += other.label_counts[l];
+            changed_labels[id] = true;
+
+            mapped_vector<int> &counts_for_label = label_word_counts[id];
+            const mapped_vector<int> &theirs = other.label_word_counts[l];
+            for (uint32_t w = 0; w < theirs.size(); ++w) {
+                if (theirs[w] == 0) continue;
+                if (counts_for_label.size() <= word_ids[w]) {
+                    counts_for_label.resize(num_words());
+                }
+                counts_for_label[word_ids[w]] += theirs[w];
+            }
+        }
+    }
+
+    // Remove the counts of another model, which must have been added to this
+    // one.  Words and labels left without posts keep their IDs with zero
+    // counts, which predict the same as never having seen them, except that
+    // a label without posts is never predicted.
+    void subtract(const Classifier &other) {
+        check_hashing(other);
+        total_posts -= other.total_posts;
+
+        std::vector<uint32_t> word_ids(other.num_words());
+        for (uint32_t w = 0; w < word_ids.size(); ++w) {
+            word_ids[w] = hash_bits ? w : vocabulary.find(other.vocabulary.str(w));
+            word_counts[word_ids[w]] -= other.word_counts[w];
+            changed_words[word_ids[w]] = true;
+        }
+
+        for (uint32_t l = 0; l < other.labels.size(); ++l) {
+            uint32_t id = labels.find(other.labels.str(l));
+            label_counts[id] -= other.label_counts[l];
+            changed_labels[id] = true;
+
+            mapped_vector<int> &counts_for_label = label_word_counts[id];
+            const mapped_vector<int> &theirs = other.label_word_counts[l];
+            for (uint32_t w = 0; w < theirs.size(); ++w) {
+                if (theirs[w] != 0) counts_for_label[word_ids[w]] -= theirs[w];
+            }
+        }
+    }
+
+    // Count one post
+    void add_post(std::string_view label, std::string_view content) {
+        ++total_posts;
+        uint32_t l = intern_label(label);
+        label_counts[l]++;
+        changed_labels[l] = true;
+
+        // Extract unique words in this post
+        const std::vector<std::string_view> &words_in_post = unique_words(content);
+        mapped_vector<int> &counts_for_label = label_word_counts[l];
+        for (std::string_view w : words_in_post) {
+            uint32_t id = intern_word(w);
+            ++word_counts[id];              // total #posts containing w (all labels)
+            changed_words[id] = true;
+            if (counts_for_label.size() <= id) {
+                counts_for_label.resize(num_words());
+            }
+            ++counts_for_label[id];         // #posts w/ this label containing w
+        }
+    }
+
+    // Count words by bucket instead of by word: each word is hashed into one
+    // of 2^bits buckets, and no word strings are kept.  Memory stays
+    // proportional to labels x buckets however many distinct words the posts
+    // have, at the cost of accuracy where words share a bucket.  Must be
+    // called while the model is empty; bits == 0 keeps exact words.
+    void hash_words(unsigned bits) {
+        if (bits == 0) return;
+        if (bits > MAX_HASH_BITS || total_posts != 0 || vocabulary.size() != 0) {
+            throw std::invalid_argument("cannot hash the words of this model");
+        }
+        hash_bits = bits;
+        word_counts.assign(num_words(), 0);
+        changed_words.assign(num_words(), true);
+    }
+
+    static constexpr unsigned MAX_HASH_BITS = 30;
+
+    // Drop rare words from the vocabulary and every count.  Keeps the words
+    // in at least min_count posts, then only the max_vocab most common of
+    // those if max_vocab > 0 (ties go to the alphabetically first word).
+    // Pruned words score as words never seen, CASE 1 of
+    // word_log_likelihood().  The kept words are renumbered alphabetically,
+    // so the table rows a post's sorted words add are in increasing memory
+    // order.  Recompiles the model.
+    void prune(int min_count, size_t max_vocab) {
+        if (hash_bits) {
+            throw std::invalid_argument("cannot prune the buckets of a hashed model");
+        }
+        std::vector<uint32_t> kept;
+        for (uint32_t w = 0; w < vocabulary.size(); ++w) {
+            if (word_counts[w] >= min_count) kept.push_back(w);
+        }
+        if (max_vocab > 0 && kept.size() > max_vocab) {
+            auto more_common = [&](uint32_t a, uint32_t b) {
+                return word_counts[a] > word_counts[b] ||
+                    (word_counts[a] == word_counts[b] &&
+                     vocabulary.str(a) < vocabulary.str(b));
+            };
+            std::nth_element(kept.begin(), kept.begin() + max_vocab, kept.end(),
+                             more_common);
+            kept.resize(max_vocab);
+        }
+        sort_by_string(kept, vocabulary);
+
+        interner kept_words(memory.get());
+        mapped_vector<int> kept_counts(memory.get());
+        for (uint32_t w : kept) {
+            kept_words.intern(vocabulary.str(w));
+            kept_counts.push_back(word_counts[w]);
+        }
+        for (auto &row : label_word_counts) {
+            mapped_vector<int> kept_row(kept.size(), 0, memory.get());
+            for (uint32_t id = 0; id < kept.size(); ++id) {
+                if (kept[id] < row.size()) kept_row[id] = row[kept[id]];
+            }
+            row = std::move(kept_row);
+        }
+        vocabulary = std::move(kept_words);
+        word_counts = std::move(kept_counts);
+        compile();
+    }
+
+    // Bytes of the counts, interned words and compiled table
+    size_t model_bytes() const {
+        size_t bytes = vocabulary.bytes() + labels.bytes() +
+            (label_counts.size() + word_counts.size()) * sizeof(int) +
+            log_occurrences.size() * sizeof(double);
+        for (const auto &row : label_word_counts) {
+            bytes += row.size() * sizeof(int);
+        }
+        for (const auto &block : table_blocks) {
+            bytes += block.size() * sizeof(double);
+        }
+        return bytes;
+    }
+    // Write the counts and interned strings to a binary model file
+    void save(const std::string &filename) const {
+        uint64_t sections = 0;
+        arrays(*this, [&](const auto &) { ++sections; });
+        model_writer out(filename, total_posts, sections, hash_bits);
+        arrays(*this, [&](const auto &array) { out.section(array); });
+        out.close();
+    }
+
+    // Replace this model with one from a binary model file.  Counts and
+    // interned strings are used in place from the mapped file, which stays
+    // mapped while any model refers to it; only the compiled tables are
+    // rebuilt.  Throws model_file_error for unusable files.
+    void load(const std::string &filename) {
+        auto mapped = std::make_shared<model_reader>(filename);
+        Classifier loaded(memory.get());
+        loaded.quantized = quantized;
+        loaded.sparse = sparse;
+        loaded.specialized = specialized;
+        loaded.file = mapped;
+        int64_t posts = mapped->total_posts();
+        if (posts <= 0 || posts > std::numeric_limits<int>::max()) {
+            throw model_file_error("Error reading model file: " + filename +
+                                   ": post count out of range");
+        }
+        loaded.total_posts = static_cast<int>(posts);
+        loaded.hash_bits = mapped->hash_bits();
+        uint64_t sections = 0;
+        arrays(loaded, [&](auto &array) {
+            if (sections++ < mapped->num_sections()) mapped->section(array);
+        });
+        if (sections != mapped->num_sections() || !loaded.consistent()) {
+            throw model_file_error("Error reading model file: " + filename +
+                                   ": inconsistent model");
+        }
+        loaded.compile();
+        *this = std::move(loaded);
+    }
+
+    // Move each count and string array this model owns, and each block of
+    // the compiled table, into a block of its own, and borrow it back.
+    // Copies of the model then share those blocks instead of copying them,
+    // and changing the model afterwards copies only the arrays it changes,
+    // such as the count rows of labels that got new posts and the table
+    // blocks of their words.
+    void share_counts() {
+        auto share = [](auto &array) {
+            if (array.is_borrowed()) return;
+            using array_type = std::decay_t<decltype(array)>;
+            auto block = std::make_shared<const array_type>(std::move(array));
+            array.borrow(block->data(), block->size(), block);
+        };
+        arrays(*this, share);
+        for (auto &block : table_blocks) {
+            share(block);
+        }
+    }
+
+    // Precompute everything predict() needs from the counts: log-priors and a
+    // word x label table of log counts, with labels in alphabetical order.
+    // train() calls this; call it again, or refresh(), after changing counts.
+    void compile() {
+        run_stats::scoped_timer timer(COMPILE_TIME);
+        std::vector<uint32_t> ids = sorted_label_ids();
+        sorted_labels.assign(ids.begin(), ids.end());
+        set_stride();
+        compile_priors();
+        unseen_word.assign(stride, FALLBACK);
+
+        log_occurrences.resize(num_words());
+        for (uint32_t w = 0; w < num_words(); ++w) {
+            log_occurrences[w] = log_occurrence(w);
+        }
+        table_blocks.clear();
+        grow_table(num_words());
+        for (uint32_t w = 0; w < num_words(); ++w) {
+            double *row = writable_row(w);
+            for (size_t col = 0; col < sorted_labels.size(); ++col) {
+                row[col] = compiled_cell(sorted_labels[col], w);
+            }
+        }
+        if (quantized) quantize_table();
+        if (sparse) index_table();
+        clear_changes();
+    }
+
+    // Bring the compiled tables up to date after counts changed, with the
+    // same results as compile().  A cell of the table depends only on the
+    // count of its word and label, so only these values are recomputed:
+    //  - cells of words and labels whose counts both changed
+    //  - log_occurrences of words whose counts changed
+    //  - log-priors and log label counts, once per label
+    // A new label gets a column of its own; the other columns are moved to
+    // make room for it, not recomputed.  The quantized table and the
+    // inverted index, if on, are rebuilt from the compiled table.
+    void refresh() {
+        run_stats::scoped_timer timer(COMPILE_TIME);
+        if (sorted_labels.size() != labels.size()) {
+            insert_columns();
+        }
+        compile_priors();
+
+        size_t compiled_words = log_occurrences.size();
+        log_occurrences.resize(num_words());
+        for (uint32_t w = 0; w < num_words(); ++w) {
+            if (w >= compiled_words || changed_words[w]) {
+                log_occurrences[w] = log_occurrence(w);
+            }
+        }
+
+        std::vector<size_t> changed_cols;
+        for (size_t col = 0; col < sorted_labels.size(); ++col) {
+            if (changed_labels[sorted_labels[col]]) changed_cols.push_back(col);
+        }
+        grow_table(num_words());
+        if (!changed_cols.empty()) {
+            for (uint32_t w = 0; w < num_words(); ++w) {
+                if (w < compiled_words && !changed_words[w]) continue;
+                double *row = writable_row(w);
+                for (size_t col : changed_cols) {
+                    row[col] = compiled_cell(sorted_labels[col], w);
+                }
+            }
+        }
+        if (quantized) quantize_table();
+        if (sparse) index_table();
+        clear_changes();
+    }
+
+    // Let predict() find its candidates in a 16-bit fixed-point copy of the
+    // table, a quarter the size of the doubles, and rescore only the labels
+    // that could still be best in double precision.  Its results are the
+    // same as without; predict_topk() always scores exactly.  on == false
+    // drops the copy.
+    void quantize(bool on = true) {
+        quantized = on;
+        if (on && !sorted_labels.empty()) {
+            quantize_table();
+        }
+        else if (!on) {
+            quantized_unseen.clear();
+            quantized_likelihoods.clear();
+            quantized_likelihoods.shrink_to_fit();
+        }
+    }
+
+    // Let predict() and predict_topk() score with a Scorer compiled for the
+    // table's width, for models of up to MAX_FIXED_STRIDE labels.  On by
+    // default; the results are the same either way.
+    void specialize(bool on = true) {
+        specialized = on;
+    }
+
+    // Let predict() start every label from a baseline shared by all labels
+    // and correct only the labels each word was seen with, found through an
+    // inverted index.  With many labels, most words are seen with few of
+    // them, so far fewer cells are read than by adding whole rows.  Its
+    // results are the same as without, and it takes precedence over
+    // quantize(); predict_topk() always scores exactly.  on == false drops
+    // the index.
+    void index_words(bool on = true) {
+        sparse = on;
+        if (on && !sorted_labels.empty()) {
+            index_table();
+        }
+        else if (!on) {
+            posting_begin.clear();
+            posting_col.clear();
+            posting_col.shrink_to_fit();
+            posting_value.clear();
+            posting_value.shrink_to_fit();
+        }
+    }
+
+    // Print training summary.
+    // - Always prints "trained on X examples"
+    // - If train_only_mode == true, also prints vocabulary size, label details,
+    //   and word likelihoods
+    void print_training_summary(bool train_only_mode) const {
+        // 1) total number of examples
+        std::cout << "trained on " << total_posts << " examples\n";
+
+        // 2) If "train-only" mode, print the rest
+        if (train_only_mode) {
+            std::cout << "vocabulary size = " << num_words() << "\n\n";
+
+            // Print label info in alphabetical order
+            std::cout << "classes:\n";
+            std::vector<uint32_t> sorted_labels = sorted_label_ids();
+
+            // For each label, print count and log-prior
+            for (uint32_t lbl : sorted_labels) {
+                double prior = double(label_counts[lbl]) / double(total_posts);
+                double log_prior = std::log(prior);
+
+                std::cout << "  " << labels.str(lbl) << ", "
+                     << label_counts[lbl] << " examples, "
+                     << "log-prior = ";
+                print_mixed_precision(log_prior);
+                std::cout << "\n";
+            }
+
+            // Print classifier parameters
+            std::cout << "classifier parameters:\n";
+            for (uint32_t lbl : sorted_labels) {
+                // Gather words used by this label, in alphabetical order
+                const mapped_vector<int> &counts_for_label = label_word_counts[lbl];
+                std::vector<uint32_t> words_for_label;
+                for (uint32_t w = 0; w < counts_for_label.size(); ++w) {
+                    if (counts_for_label[w] > 0) words_for_label.push_back(w);
+                }
+                // Hashed words are shown by bucket, in bucket order
+                if (!hash_bits) sort_by_string(words_for_label, vocabulary);
+
+                for (uint32_t w : words_for_label) {
+                    int count_label_word = counts_for_label[w];
+                    double numerator   = double(count_label_word);
+                    double denominator = double(label_counts[lbl]);
+                    // log( (#posts label & word) / (#posts label) )
+                    double ll = std::log(numerator / denominator);
+
+                    std::cout << "  " << labels.str(lbl) << ":";
+                    if (hash_bits) std::cout << '#' << w;
+                    else std::cout << vocabulary.str(w);
+                    std::cout << ", count = " << count_label_word
+                         << ", log-likelihood = ";
+                    print_mixed_precision(ll);
+                    std::cout << "\n";
+                }
+            }
+            std::cout << "\n";
+        }
+    }
+
+    size_t vocabulary_size() const { return num_words(); }
+    size_t num_labels() const { return labels.size(); }
+    int num_posts() const { return total_posts; }
+
+    // Predict a label for a new post, given its unique words in sorted order.
+    // Returns {best_label, best_log_score}.  Requires an up-to-date compile().
+    std::pair<std::string, double>
+    predict(const std::vector<std::string_view> &post_words) const {
+        run_stats::scoped_timer timer(SCORE_TIME);
+        run_stats::count(PREDICTIONS);
+        std::vector<double> scores =
+            sparse ? score_sparse(post_words) :
+            quantized && post_words.size() <= MAX_QUANTIZED_WORDS
+            ? score_candidates(post_words) : score_exact(post_words);
+
+        // Labels are in alphabetical order, which breaks ties
+        std::string_view best_label;
+        double best_score = -std::numeric_limits<double>::infinity();
+
+        for (size_t col = 0; col < sorted_labels.size(); ++col) {
+            std::string_view lbl = labels.str(sorted_labels[col]);
+            double score = scores[col];
+
+            // Check if this is the best so far (tie-break on alphabetical label)
+            if ((score > best_score) ||
+                (std::fabs(score - best_score) < 1e-14 && lbl < best_label)) {
+                best_score = score;
+                best_label = lbl;
+            }
+        }
+        return {std::string(best_label), best_score};
+    }
+
+    struct Candidate {
+        std::string label;
+        double log_score;
+        double probability;     // normalized over all labels
+    };
+
+    // The k best labels for a post, given its unique words in sorted order,
+    // best first.  Equal scores are ordered alphabetically by label, so the
+    // first candidate is the label predict() returns.  Only the top k are
+    // sorted, after a linear-time selection.
+    std::vector<Candidate> predict_topk(const std::vector<std::string_view> &post_words,
+                                        size_t k) const {
+        run_stats::scoped_timer timer(SCORE_TIME);
+        run_stats::count(PREDICTIONS);
+        std::vector<double> scores = score_exact(post_words);
+
+        // Columns are in alphabetical order of label
+        std::vector<uint32_t> cols(sorted_labels.size());
+        for (uint32_t col = 0; col < cols.size(); ++col) cols[col] = col;
+        auto better = [&](uint32_t a, uint32_t b) {
+            return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+        };
+        k = std::min(k, cols.size());
+        if (k < cols.size()) {
+            std::nth_element(cols.begin(), cols.begin() + k, cols.end(), better);
+        }
+        std::sort(cols.begin(), cols.begin() + k, better);
+
+        // Probabilities by log-sum-exp over every label
+        double max_score = cols.empty() ? 0.0 : scores[cols[0]];
+        double sum = 0.0;
+        for (size_t col = 0; col < cols.size(); ++col) {
+            sum += std::exp(scores[col] - max_score);
+        }
+        double log_total = max_score + std::log(sum);
+
+        std::vector<Candidate> top;
+        for (size_t i = 0; i < k; ++i) {
+            double score = scores[cols[i]];
+            top.push_back({std::string(labels.str(sorted_labels[cols[i]])), score,
+                           std::exp(score - log_total)});
+        }
+        return top;
+    }
+
+private:
+    // The resource new arrays come from, which follows the containers'
+    // allocators: a copy of a model allocates from the default resource,
+    // not the resource of the model it copied, which it does not own, and
+    // an assigned model keeps its own.  Only moving a model hands it on.
+    class model_memory {
+    public:
+        model_memory(std::pmr::memory_resource *resource) : resource(resource) {}
+        model_memory(const model_memory &) : resource(std::pmr::get_default_resource()) {}
+        model_memory(model_memory &&) = default;
+        model_memory & operator= (const model_memory &) { return *this; }
+        model_memory & operator= (model_memory &&) { return *this; }
+        std::pmr::memory_resource * get() const { return resource; }
+
+    private:
+        std::pmr::memory_resource *resource;
+    };
+
+    model_memory memory;
+    int total_posts = 0;
+    interner vocabulary; // All unique words in training data, as dense IDs
+    unsigned hash_bits = 0;  // If not 0, word IDs are hash buckets instead
+
+    // Number of word IDs: words in the vocabulary, or hash buckets
+    uint32_t num_words() const {
+        return hash_bits ? uint32_t(1) << hash_bits : uint32_t(vocabulary.size());
+    }
+
+    // ID of a word, or interner::NONE if it was never seen.  A hashed word
+    // always has a bucket; an empty bucket scores as an unseen word.
+    uint32_t find_word(std::string_view word) const {
+        return hash_bits ? bucket(word) : vocabulary.find(word);
+    }
+
+    // FNV-1a, folded to 32 bits so every bit of the hash picks the bucket
+    uint32_t bucket(std::string_view word) const {
+        uint64_t h = 14695981039346656037u;
+        for (char c : word) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211u;
+        }
+        return uint32_t(h ^ (h >> 32)) & (num_words() - 1);
+    }
+
+    // Models can only be combined if they map words to IDs the same way
+    void check_hashing(const Classifier &other) const {
+        if (hash_bits != other.hash_bits) {
+            throw std::invalid_argument("cannot combine models with different hashing");
+        }
+    }
+    interner labels;     // All labels in training data, as dense IDs
+
+    // label ID -> #posts with that label
+    mapped_vector<int> label_counts;
+
+    // word ID -> #posts (across all labels) containing that word
+    mapped_vector<int> word_counts;
+
+    // label ID -> (word ID -> #posts with label that contain word).  Rows
+    // only extend up to the largest word ID seen with their label.
+    std::pmr::vector<mapped_vector<int>> label_word_counts;
+
+    // Labels and words whose counts changed since the last compile()
+    std::vector<bool> changed_labels;
+    std::vector<bool> changed_words;
+
+    void clear_changes() {
+        changed_labels.assign(labels.size(), false);
+        changed_words.assign(num_words(), false);
+    }
+
+    // Marks a cell of the compiled table whose label never saw the word
+    static constexpr double FALLBACK = std::numeric_limits<double>::quiet_NaN();
+
+    // log(#posts with label that contain word) if there are any, or
+    // FALLBACK.  Minus log(#posts with label), this is CASE 3 of
+    // word_log_likelihood().
+    double compiled_cell(uint32_t label, uint32_t word) const {
+        const mapped_vector<int> &counts_for_label = label_word_counts[label];
+        if (word < counts_for_label.size() && counts_for_label[word] > 0) {
+            return std::log(static_cast<double>(counts_for_label[word]));
+        }
+        return FALLBACK;
+    }
+
+    // log(#posts containing word), or 0 if subtract() took away every post
+    // containing it.  Minus log_total, this is word_log_likelihood() for
+    // any label without the word: CASE 2, or CASE 1 for a count of 0.
+    double log_occurrence(uint32_t word) const {
+        return word_counts[word] ? std::log(double(word_counts[word])) : 0.0;
+    }
+
+    // Value of the FALLBACK cells of a word ID, or interner::NONE
+    double fallback_of(uint32_t id) const {
+        return id == interner::NONE ? -log_total : log_occurrences[id] - log_total;
+    }
+
+    // Row of the compiled table for a word ID, or interner::NONE
+    const double *word_row(uint32_t id) const {
+        if (id == interner::NONE) return unseen_word.data();
+        size_t first = (id & block_mask()) * stride;
+        return table_blocks[id >> block_shift].data() + first;
+    }
+
+    // word_row() of a word in the table, to change; a shared block is copied
+    double *writable_row(uint32_t id) {
+        return &table_blocks[id >> block_shift][(id & block_mask()) * stride];
+    }
+
+    // Take log(#posts with label) off the score of a column once for each
+    // of the post's words its label saw
+    double finish_score(size_t col, double score, double seen) const {
+        return seen > 0.0 ? score - seen * log_label_counts[col] : score;
+    }
+
+    // finish_score() for every column, with the counts from add_row()
+    void finish_scores(double *scores, const double *seen) const {
+        for (size_t col = 0; col < sorted_labels.size(); ++col) {
+            scores[col] = finish_score(col, scores[col], seen[col]);
+        }
+    }
+
+    // Model file the counts are mapped from, if any
+    std::shared_ptr<model_reader> file;
+
+    // Log-score of every label for a post, by column:
+    //    log(#posts w/ label / total_posts) + sum( log(P(w|label)) for w in post_words )
+    // Summation is done in alphabetical order for consistency.  Every
+    // label is scored at once by adding whole rows of the compiled table.
+    std::vector<double> score_labels(const std::vector<std::string_view> &post_words)
+        const {
+        std::vector<double> scores(log_priors.begin(), log_priors.end());
+        std::vector<double> seen(stride, 0.0);
+        for (std::string_view w : post_words) {
+            uint32_t id = find_word(w);
+            add_row(scores.data(), seen.data(), word_row(id), fallback_of(id), stride);
+        }
+        finish_scores(scores.data(), seen.data());
+        return scores;
+    }
+
+    // Widest table, in columns, with a Scorer of its own
+    static constexpr size_t MAX_FIXED_STRIDE = 16;
+    bool specialized = true;
+
+    // score_labels() by Scorer<Columns>, for a table Columns wide
+    template <size_t Columns>
+    std::vector<double> score_fixed(const std::vector<std::string_view> &post_words)
+        const {
+        std::vector<double> scores(Columns);
+        double seen[Columns];
+        Scorer<Columns>::score(log_priors.data(), post_words.size(),
+                               [&](size_t i, double &fallback) {
+            uint32_t id = find_word(post_words[i]);
+            fallback = fallback_of(id);
+            return word_row(id);
+        }, scores.data(), seen);
+        finish_scores(scores.data(), seen);
+        return scores;
+    }
+
+    using score_function = std::vector<double> (Classifier::*)(
+        const std::vector<std::string_view> &) const;
+
+    // score_fixed() for every even width up to MAX_FIXED_STRIDE
+    template <size_t... I>
+    static constexpr std::array<score_function, sizeof...(I)>
+    fixed_scorers(std::index_sequence<I...>) {
+        return {{&Classifier::score_fixed<2 * (I + 1)>...}};
+    }
+
+    // score_labels(), by the Scorer for the table's width if it has one.
+    // The width is only known once the labels are, so the kernel is picked
+    // at run time.
+    std::vector<double> score_exact(const std::vector<std::string_view> &post_words)
+        const {
+        static constexpr std::array<score_function, MAX_FIXED_STRIDE / 2> FIXED =
+            fixed_scorers(std::make_index_sequence<MAX_FIXED_STRIDE / 2>());
+        if (specialized && stride >= 2 && stride <= MAX_FIXED_STRIDE) {
+            return (this->*FIXED[stride / 2 - 1])(post_words);
+        }
+        return score_labels(post_words);
+    }
+
+    // Apply f to every array saved in a model file, always in the same order.
+    // When loading, label rows are created once the labels are known.
+    template <typename Self, typename F>
+    static void arrays(Self &self, F &&f) {
+        self.vocabulary.arrays(f);
+        self.labels.arrays(f);
+        f(self.label_counts);
+        f(self.word_counts);
+        if constexpr (!std::is_const<Self>::value) {
+            self.label_word_counts.resize(self.labels.size());
+        }
+        for (auto &row : self.label_word_counts) {
+            f(row);
+        }
+    }
+
+    // Check that array sizes agree, so a loaded model is safe to index
+    bool consistent() const {
+        if (!vocabulary.consistent() || !labels.consistent() ||
+            label_counts.size() != labels.size() ||
+            hash_bits > MAX_HASH_BITS || (hash_bits && vocabulary.size() != 0) ||
+            word_counts.size() != num_words() || total_posts <= 0) {
+            return false;
+        }
+        for (const auto &row : label_word_counts) {
+            if (row.size() > num_words()) return false;
+        }
+        return true;
+    }
+
+    // Compiled model.  Columns are labels in alphabetical order, padded to
+    // an even stride so rows can be added two lanes at a time.  A cell holds
+    // log(#posts with label that contain w), or FALLBACK if there are none.
+    // The terms that depend on other counts are applied while scoring: the
+    // value of a FALLBACK cell, from log_occurrences and log_total, and
+    // log(#posts with label) once for each word the label saw.  So counting
+    // more posts only changes the cells of their own words and labels.  The
+    // table is cut into blocks of whole rows, about BLOCK_BYTES each, so a
+    // copy of the model shares every block a change left alone.
+    std::pmr::vector<uint32_t> sorted_labels;  // column -> label ID
+    size_t stride = 0;
+    double log_total = 0.0;                    // log(total_posts)
+    std::pmr::vector<double> log_priors;       // column -> log-prior
+    std::pmr::vector<double> log_label_counts; // column -> log(#posts with label)
+    std::pmr::vector<double> unseen_word;      // column -> FALLBACK
+    std::pmr::vector<double> log_occurrences;  // word ID -> log_occurrence()
+    size_t block_shift = 0;                    // 1 << block_shift rows per block
+    // word ID >> block_shift -> (word ID & block_mask()) * stride + column -> cell
+    std::pmr::vector<mapped_vector<double>> table_blocks;
+
+    static constexpr size_t BLOCK_BYTES = 65536;
+
+    size_t block_mask() const {
+        return (size_t(1) << block_shift) - 1;
+    }
+
+    // Lay out sorted_labels.size() columns, and as many rows per block as
+    // fit in BLOCK_BYTES, at least one.  With no labels the rows are empty,
+    // and blocks are sized as if they had one column.
+    void set_stride() {
+        stride = (sorted_labels.size() + 1) & ~size_t(1);
+        size_t row_bytes = std::max<size_t>(stride, 1) * sizeof(double);
+        block_shift = 0;
+        while ((size_t(2) << block_shift) * row_bytes <= BLOCK_BYTES) {
+            ++block_shift;
+        }
+    }
+
+    // Extend the compiled table to rows for words IDs, of FALLBACK cells
+    void grow_table(size_t words) {
+        size_t rows = size_t(1) << block_shift;
+        size_t blocks = (words + rows - 1) >> block_shift;
+        table_blocks.resize(blocks);
+        for (size_t b = 0; b < blocks; ++b) {
+            size_t cells = std::min(rows, words - b * rows) * stride;
+            if (table_blocks[b].size() < cells) table_blocks[b].resize(cells, FALLBACK);
+        }
+    }
+
+    // Log-priors, log label counts and log_total, from the counts
+    void compile_priors() {
+        log_total = std::log(static_cast<double>(total_posts));
+        log_priors.assign(stride, 0.0);
+        log_label_counts.assign(stride, 0.0);
+        for (size_t col = 0; col < sorted_labels.size(); ++col) {
+            uint32_t lbl = sorted_labels[col];
+            log_priors[col] = std::log(double(label_counts[lbl]) / double(total_posts));
+            log_label_counts[col] = std::log(static_cast<double>(label_counts[lbl]));
+        }
+    }
+
+    // Give labels added since the last compile() their columns, in
+    // alphabetical order, moving the compiled cells of the others along.
+    // The new columns are left for refresh() to fill in.
+    void insert_columns() {
+        std::vector<uint32_t> ids = sorted_label_ids();
+        std::vector<size_t> new_col(labels.size());
+        for (size_t col = 0; col < ids.size(); ++col) {
+            new_col[ids[col]] = col;
+        }
+        std::vector<uint32_t> old_labels(sorted_labels.begin(), sorted_labels.end());
+        size_t old_stride = stride;
+        size_t old_shift = block_shift;
+        const std::pmr::vector<mapped_vector<double>> old_table = std::move(table_blocks);
+
+        sorted_labels.assign(ids.begin(), ids.end());
+        set_stride();
+        unseen_word.assign(stride, FALLBACK);
+        table_blocks.clear();
+        size_t words = log_occurrences.size();
+        grow_table(words);
+        for (uint32_t w = 0; w < words; ++w) {
+            size_t first = (w & ((size_t(1) << old_shift) - 1)) * old_stride;
+            const double *old_row = old_table[w >> old_shift].data() + first;
+            double *row = writable_row(w);
+            for (size_t col = 0; col < old_labels.size(); ++col) {
+                row[new_col[old_labels[col]]] = old_row[col];
+            }
+        }
+    }
+
+    // Quantized copy of the compiled table, if quantize() was called.  Each
+    // column c holds q for the value quantized_offset[c] + q * quantized_step[c],
+    // which is at most quantized_error[c] away from the double.  Columns are
+    // padded to a multiple of 8 so rows can be added eight lanes at a time.
+    bool quantized = false;
+    size_t quantized_stride = 0;
+    std::pmr::vector<int16_t> quantized_unseen;      // column -> CASE 1
+    // word ID * quantized_stride + column
+    std::pmr::vector<int16_t> quantized_likelihoods;
+    std::pmr::vector<double> quantized_offset;
+    std::pmr::vector<double> quantized_step;
+    std::pmr::vector<double> quantized_error;
+
+    // Inverted index of the compiled table, if index_words() was called.
+    // The postings of word w, posting_begin[w] up to posting_begin[w + 1],
+    // are the columns where its cell is not FALLBACK, in order, and the cell.
+    bool sparse = false;
+    std::pmr::vector<uint32_t> posting_begin; // word ID -> first posting
+    std::pmr::vector<uint32_t> posting_col;
+    std::pmr::vector<double> posting_value;
+
+    // Sums of this many 16-bit values cannot overflow 32 bits
+    static constexpr size_t MAX_QUANTIZED_WORDS = 65536;
+
+    // Build the quantized table from the compiled one.  Each column gets its
+    // own scale, spreading its range of values over the int16 range.
+    void quantize_table() {
+        size_t cols = sorted_labels.size();
+        size_t words = log_occurrences.size();
+        quantized_stride = (cols + 7) & ~size_t(7);
+        quantized_offset.assign(quantized_stride, 0.0);
+        quantized_step.assign(quantized_stride, 1.0);
+        quantized_error.assign(quantized_stride, 0.0);
+        // Quantize the log-likelihoods the cells stand for, FALLBACK
+        // cells included
+        std::vector<double> values(stride);
+        auto values_of = [&](uint32_t id) {
+            const double *row = word_row(id);
+            for (size_t col = 0; col < cols; ++col) {
+                values[col] = std::isnan(row[col])
+                    ? fallback_of(id) : row[col] - log_label_counts[col];
+            }
+            return values.data();
+        };
+        std::vector<double> lo(cols, -log_total);
+        std::vector<double> hi(lo);
+        for (size_t w = 0; w < words; ++w) {
+            const double *row = values_of(static_cast<uint32_t>(w));
+            for (size_t col = 0; col < cols; ++col) {
+                lo[col] = std::min(lo[col], row[col]);
+                hi[col] = std::max(hi[col], row[col]);
+            }
+        }
+        std::vector<double> scale(cols, 0.0);
+        for (size_t col = 0; col < cols; ++col) {
+            double half = (hi[col] - lo[col]) / 2.0;
+            quantized_offset[col] = lo[col] + half;
+            if (half > 0.0) {
+                quantized_step[col] = half / 32767.0;
+                scale[col] = 32767.0 / half;
+            }
+        }
+
+        auto quantize_row = [&](const double *row, int16_t *out) {
+            for (size_t col = 0; col < cols; ++col) {
+                double q = std::round((row[col] - quantized_offset[col]) * scale[col]);
+                q = std::min(32767.0, std::max(-32767.0, q));
+                out[col] = static_cast<int16_t>(q);
+                double error = std::fabs(row[col] - quantized_value(col, out[col]));
+                quantized_error[col] = std::max(quantized_error[col], error);
+            }
+        };
+        quantized_unseen.assign(quantized_stride, 0);
+        quantize_row(values_of(interner::NONE), quantized_unseen.data());
+        quantized_likelihoods.assign(words * quantized_stride, 0);
+        for (size_t w = 0; w < words; ++w) {
+            quantize_row(values_of(static_cast<uint32_t>(w)),
+                         &quantized_likelihoods[w * quantized_stride]);
+        }
+    }
+
+    double quantized_value(size_t col, int32_t q) const {
+        return quantized_offset[col] + q * quantized_step[col];
+    }
+
+    // Log-scores like score_labels(), from the quantized table.  Every label
+    // whose approximate score, give or take its error bound, could reach the
+    // best label's is rescored exactly by rescore().
+    std::vector<double>
+    score_candidates(const std::vector<std::string_view> &post_words) const {
+        std::vector<uint32_t> ids;
+        ids.reserve(post_words.size());
+        std::vector<int32_t> sums(quantized_stride, 0);
+        for (std::string_view w : post_words) {
+            uint32_t id = find_word(w);
+            ids.push_back(id);
+            const int16_t *row = id == interner::NONE
+                ? quantized_unseen.data() : &quantized_likelihoods[id * quantized_stride];
+            add_row(sums.data(), row, quantized_stride);
+        }
+
+        // Bounds on each label's exact score, with slack for the rounding
+        // of the bounds themselves
+        size_t cols = sorted_labels.size();
+        double n = static_cast<double>(post_words.size());
+        std::vector<double> approx(cols);
+        std::vector<double> margin(cols);
+        for (size_t col = 0; col < cols; ++col) {
+            approx[col] = log_priors[col] + n * quantized_offset[col] +
+                          sums[col] * quantized_step[col];
+            margin[col] = n * quantized_error[col] +
+                          1e-9 * (1.0 + std::fabs(approx[col]));
+        }
+        return rescore(ids, approx, margin);
+    }
+
+    // Build the inverted index from the compiled table.  Words seen with
+    // only a few labels have only a few cells that are not FALLBACK, and
+    // only those are listed.
+    void index_table() {
+        size_t cols = sorted_labels.size();
+        size_t words = log_occurrences.size();
+        posting_begin.assign(words + 1, 0);
+        posting_col.clear();
+        posting_value.clear();
+        for (uint32_t w = 0; w < words; ++w) {
+            const double *row = word_row(w);
+            for (size_t col = 0; col < cols; ++col) {
+                if (!std::isnan(row[col])) {
+                    posting_col.push_back(static_cast<uint32_t>(col));
+                    posting_value.push_back(row[col]);
+                }
+            }
+            posting_begin[w + 1] = static_cast<uint32_t>(posting_col.size());
+        }
+    }
+
+    // Log-scores like score_labels(), from the inverted index.  Every label
+    // starts from its log-prior plus the fallbacks of the post's words, and
+    // only the labels on each word's postings are corrected.  That adds the
+    // terms in another order, so as in score_candidates() the labels that
+    // could be best are rescored exactly.
+    std::vector<double> score_sparse(const std::vector<std::string_view> &post_words)
+        const {
+        std::vector<uint32_t> ids;
+        std::vector<double> fallbacks;
+        ids.reserve(post_words.size());
+        fallbacks.reserve(post_words.size());
+        double baseline = 0.0;
+        for (std::string_view w : post_words) {
+            uint32_t id = find_word(w);
+            double fallback = fallback_of(id);
+            ids.push_back(id);
+            fallbacks.push_back(fallback);
+            baseline += fallback;
+        }
+
+        size_t cols = sorted_labels.size();
+        std::vector<double> approx(cols);
+        for (size_t col = 0; col < cols; ++col) {
+            approx[col] = log_priors[col] + baseline;
+        }
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (ids[i] == interner::NONE) continue;
+            for (uint32_t p = posting_begin[ids[i]]; p < posting_begin[ids[i] + 1]; ++p) {
+                uint32_t col = posting_col[p];
+                approx[col] += posting_value[p] - log_label_counts[col] - fallbacks[i];
+            }
+        }
+
+        // Either way of adding up a score is off by at most a few times
+        // (n + 2) * epsilon * (|approx| + |baseline| + n * log(total_posts)),
+        // no log count being larger than log(total_posts)
+        double n = static_cast<double>(post_words.size());
+        double epsilon = 8.0 * std::numeric_limits<double>::epsilon() * (n + 8.0);
+        std::vector<double> margin(cols);
+        for (size_t col = 0; col < cols; ++col) {
+            margin[col] = epsilon * (1.0 + std::fabs(approx[col]) +
+                                     2.0 * std::fabs(baseline) + 2.0 * n * log_total);
+        }
+        return rescore(ids, approx, margin);
+    }
+
+    // Exact log-scores, added in the same order as score_labels(), of every
+    // label whose approximate score, give or take its margin, could reach
+    // the best label's; -infinity for the rest.  So the best label and its
+    // score are exactly those of score_labels().
+    std::vector<double> rescore(const std::vector<uint32_t> &ids,
+                                const std::vector<double> &approx,
+                                const std::vector<double> &margin) const {
+        size_t cols = approx.size();
+        double best_low = -std::numeric_limits<double>::infinity();
+        for (size_t col = 0; col < cols; ++col) {
+            best_low = std::max(best_low, approx[col] - margin[col]);
+        }
+
+        std::vector<double> scores(cols, -std::numeric_limits<double>::infinity());
+        for (size_t col = 0; col < cols; ++col) {
+            if (approx[col] + margin[col] < best_low) continue;
+            double score = log_priors[col];
+            double seen = 0.0;
+            for (uint32_t id : ids) {
+                double cell = word_row(id)[col];
+                score += std::isnan(cell) ? fallback_of(id) : cell;
+                seen += !std::isnan(cell);
+            }
+            scores[col] = finish_score(col, score, seen);
+        }
+        return scores;
+    }
+
+    // Count every post read from csvin.  If printed is not null, writes the
+    // line-by-line training data to it.
+    void count_posts(csvmmap &csvin, std::ostream *printed) {
+        csvrow_view row;
+        while (read_post(csvin, row)) {
+            std::string_view label   = row[TAG];
+            std::string_view content = row[CONTENT];
+
+            if (printed) {
+                // Print line-by-line training data (train-only mode)
+                *printed << "  label = " << label
+                         << ", content = " << content << "\n";
+            }
+
+            add_post(label, content);
+        }
+    }
+
+    uint32_t intern_label(std::string_view label) {
+        uint32_t id = labels.intern(label);
+        if (id == label_counts.size()) {
+            label_counts.push_back(0);
+            label_word_counts.emplace_back();
+            changed_labels.push_back(true);
+        }
+        return id;
+    }
+
+    uint32_t intern_word(std::string_view word) {
+        if (hash_bits) return bucket(word);
+        uint32_t id = vocabulary.intern(word);
+        if (id == word_counts.size()) {
+            word_counts.push_back(0);
+            changed_words.push_back(true);
+        }
+        return id;
+    }
+
+    // Sort IDs by the strings they stand for
+    static void sort_by_string(std::vector<uint32_t> &ids, const interner &strings) {
+        std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+            return strings.str(a) < strings.str(b);
+        });
+    }
+
+    // Label IDs in alphabetical order of label
+    std::vector<uint32_t> sorted_label_ids() const {
+        std::vector<uint32_t> ids(labels.size());
+        for (uint32_t i = 0; i < ids.size(); ++i) ids[i] = i;
+        sort_by_string(ids, labels);
+        return ids;
+    }
+
+    /*
+     * Compute log P(word | label) according to the assignment spec.
+     * Cases:
+     *  1) If the word never appears anywhere: log(1 / (total_posts + 2))
+     *  2) If the word appears in the corpus but not under this label:
+     *     log(1 / (#posts with label + 2))
+     *  3) Otherwise: log( (# label&word) / (# label) )
+     */
+    double word_log_likelihood(uint32_t label, uint32_t word) const {
+        // "occurrences" = total # of posts containing this word
+        double occurrences = 0.0;
+        if (word != interner::NONE) {
+            occurrences = static_cast<double>(word_counts[word]);
+        }
+
+        // "candw" = # of posts that contain "word" AND have label "label",
+        // or -1 if none is recorded.
+        double candw = -1.0;
+        const mapped_vector<int> &counts_for_label = label_word_counts[label];
+        if (word < counts_for_label.size() && counts_for_label[word] > 0) {
+            candw = static_cast<double>(counts_for_label[word]);
+        }
+
+        // CASE 1: candw == -1 AND occurrences == 0 => word never appears anywhere
+        if ((candw == -1.0) && (occurrences == 0.0)) {
+            // returns ln(1 / total_posts)
+            double hold = 1.0 / static_cast<double>(total_posts);
+            return std::log(hold);
+        }
+
+        // CASE 2: candw == -1 AND occurrences != 0 => word appears globally,
+        // but not under this label
+        if ((candw == -1.0) && (occurrences != 0.0)) {
+            // returns ln(occurrences / total_posts)
+            double hold2 = occurrences / static_cast<double>(total_posts);
+            return std::log(hold2);
+        }
+
+        // CASE 3: We have a valid candw => returns ln(#(label&word)/ #(label))
+        double cTotal = static_cast<double>(label_counts[label]);
+        double hold3  = candw / cTotal;
+        return std::log(hold3);
+    }
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <iomanip>
+#include <cstdlib>
+#include <sys/resource.h>
+#include "csvstream.hpp"
+#include "csvmmap.hpp"
+#include "classifier.hpp"
+
+using namespace std;
+
+/*
+ * Benchmark for the classifier pipeline.
+ *
+ * For each dataset, given as TRAIN_CSV or TRAIN_CSV:TEST_CSV, times:
+ *   parse     reading every projected row of the training file
+ *   tokenize  splitting every training post into its unique words
+ *   train     counting the training file into a new model (parse, tokenize
+ *             and count, with --threads workers)
+ *   compile   building the log-likelihood table
+ *   predict   predicting every post of the test file (the training file if
+ *             there is none)
+ *   generic   predict again without the fixed-width kernels of
+ *             Classifier::specialize(), for up to 16 labels
+ *   quantized predict again with Classifier::quantize()
+ *   sparse    predict again with Classifier::index_words()
+ *   pruned    predict again after pruning rare words, with --min-count N or
+ *             --max-vocab M
+ * and prints a table of throughput with the peak RSS of the process since
+ * the dataset began.
+ * With --json FILE, also writes the results as JSON for tracking over time.
+ */
+
+// Minimum wall time spent on each measurement
+const double MIN_SECONDS = 0.2;
+
+struct Stage {
+    string name;
+    double seconds;     // per run
+    size_t bytes;       // input bytes per run
+    size_t posts;       // posts per run
+    long peak_rss_kb;   // peak RSS of the dataset's stages up to this one
+};
+
+struct Dataset {
+    string train_filename;
+    string test_filename;
+    size_t threads;
+    size_t vocabulary;
+    size_t pruned_vocabulary;   // vocabulary after pruning, if pruned
+    size_t model_bytes;
+    size_t pruned_model_bytes;
+    size_t labels;
+    size_t words;       // unique words per pass over the training posts
+    size_t correct;     // correct predictions per pass over the test posts
+    size_t pruned_correct;
+    vector<Stage> stages;
+};
+
+// Run body() until MIN_SECONDS have passed; return seconds per run
+template <typename Body>
+static double seconds_per_run(Body body) {
+    using clock = chrono::steady_clock;
+    size_t runs = 0;
+    auto start = clock::now();
+    double elapsed = 0.0;
+    do {
+        body();
+        ++runs;
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    return elapsed / double(runs);
+}
+
+// Start measuring peak RSS again from the current RSS.  Linux resets the
+// VmHWM of /proc/self/status when "5" is written to clear_refs.
+static void reset_peak_rss() {
+    ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Peak RSS since reset_peak_rss(), or of the whole process where VmHWM is
+// not available
+static long peak_rss_kb() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return strtol(line.c_str() + 6, nullptr, 10);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static size_t file_size(const string &filename) {
+    ifstream fin(filename, ios::binary | ios::ate);
+    return fin ? size_t(fin.tellg()) : 0;
+}
+
+// Posts of a CSV file, as views into its mapping, or into copies for a
+// compressed file
+struct Posts {
+    csvmmap csv;
+    deque<string> copies;
+    vector<string_view> labels;
+    vector<string_view> contents;
+
+    explicit Posts(const string &filename) : csv(filename, POST_COLUMNS) {
+        csvrow_view row;
+        while (csv >> row) {
+            if (!csv.in_memory()) {
+                for (PostColumn column : {TAG, CONTENT}) {
+                    copies.emplace_back(row[column]);
+                    row.fields[column] = copies.back();
+                }
+            }
+            labels.push_back(row[TAG]);
+            contents.push_back(row[CONTENT]);
+        }
+    }
+};
+
+// Rare words dropped before the pruned stage
+struct Pruning {
+    size_t min_count = 0;
+    size_t max_vocab = 0;
+};
+
+static Dataset bench_dataset(const string &train_filename, const string &test_filename,
+                             size_t threads, const Pruning &pruning) {
+    reset_peak_rss();
+    Dataset result{train_filename, test_filename, threads, 0, 0, 0, 0, 0, 0, 0, 0, {}};
+    size_t train_bytes = file_size(train_filename);
+    size_t test_bytes = file_size(test_filename);
+    Posts train_posts(train_filename);
+    Posts test_posts(test_filename);
+    size_t num_train = train_posts.contents.size();
+    size_t num_test = test_posts.contents.size();
+
+    auto add = [&](const string &name, size_t bytes, size_t posts, double seconds) {
+        result.stages.push_back({name, seconds, bytes, posts, peak_rss_kb()});
+    };
+
+    add("parse", train_bytes, num_train, seconds_per_run([&] {
+        csvmmap csv(train_filename, POST_COLUMNS);
+        csvrow_view row;
+        while (csv >> row) {}
+    }));
+
+    add("tokenize", train_bytes, num_train, seconds_per_run([&] {
+        size_t words = 0;
+        for (string_view content : train_posts.contents) {
+            words += unique_words(content).size();
+        }
+        result.words = words;
+    }));
+
+    add("train", train_bytes, num_train, seconds_per_run([&] {
+        model_arena memory;
+        Classifier nb(&memory);
+        csvmmap csv(train_filename, POST_COLUMNS);
+        nb.add_posts(csv, false, threads);
+    }));
+
+    model_arena memory;
+    Classifier nb(&memory);
+    csvmmap csv(train_filename, POST_COLUMNS);
+    nb.add_posts(csv, false, threads);
+    add("compile", 0, num_train, seconds_per_run([&] { nb.compile(); }));
+    result.vocabulary = nb.vocabulary_size();
+    result.model_bytes = nb.model_bytes();
+    result.labels = nb.num_labels();
+
+    auto predict_all = [&]() {
+        size_t correct = 0;
+        for (size_t i = 0; i < num_test; ++i) {
+            auto prediction = nb.predict(unique_words(test_posts.contents[i]));
+            correct += prediction.first == test_posts.labels[i];
+        }
+        return correct;
+    };
+    add("predict", test_bytes, num_test, seconds_per_run([&] {
+        result.correct = predict_all();
+    }));
+
+    nb.specialize(false);
+    add("generic", test_bytes, num_test, seconds_per_run([&] { predict_all(); }));
+    nb.specialize();
+
+    nb.quantize();
+    add("quantized", test_bytes, num_test, seconds_per_run([&] { predict_all(); }));
+    nb.quantize(false);
+
+    nb.index_words();
+    add("sparse", test_bytes, num_test, seconds_per_run([&] { predict_all(); }));
+    nb.index_words(false);
+
+    if (pruning.min_count || pruning.max_vocab) {
+        nb.prune(int(max<size_t>(pruning.min_count, 1)), pruning.max_vocab);
+        result.pruned_vocabulary = nb.vocabulary_size();
+        result.pruned_model_bytes = nb.model_bytes();
+        add("pruned", test_bytes, num_test, seconds_per_run([&] {
+            result.pruned_correct = predict_all();
+        }));
+    }
+    return result;
+}
+
+static void print_table(const Dataset &d) {
+    cout << d.train_filename;
+    if (d.test_filename != d.train_filename) cout << " -> " << d.test_filename;
+    cout << " (" << d.vocabulary << " words, " << d.labels << " labels, "
+         << d.threads << (d.threads == 1 ? " thread, " : " threads, ")
+         << d.correct << " predicted correctly)\n";
+    if (d.pruned_vocabulary) {
+        cout << "  pruned to " << d.pruned_vocabulary << " words, model "
+             << double(d.model_bytes) / 1e6 << " MB -> "
+             << double(d.pruned_model_bytes) / 1e6 << " MB, "
+             << d.pruned_correct << " predicted correctly\n";
+    }
+    cout << "  " << left << setw(10) << "stage" << right
+         << setw(12) << "ms/run" << setw(12) << "MB/s"
+         << setw(14) << "posts/s" << setw(14) << "peak RSS MB" << "\n";
+    for (const Stage &s : d.stages) {
+        cout << "  " << left << setw(10) << s.name << right
+             << setw(12) << setprecision(3) << s.seconds * 1e3 << setprecision(1);
+        if (s.bytes) cout << setw(12) << double(s.bytes) / s.seconds / 1e6;
+        else cout << setw(12) << "-";
+        cout << setw(14) << double(s.posts) / s.seconds
+             << setw(14) << double(s.peak_rss_kb) / 1024.0 << "\n";
+    }
+}
+
+// Filenames in this repo need no escaping beyond quotes and backslashes
+static string json_string(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void write_json(ostream &os, const vector<Dataset> &datasets) {
+    os << setprecision(6) << "{\"datasets\": [";
+    for (size_t i = 0; i < datasets.size(); ++i) {
+        const Dataset &d = datasets[i];
+        os << (i ? ",\n" : "\n") << "  {\"train\": " << json_string(d.train_filename)
+           << ", \"test\": " << json_string(d.test_filename)
+           << ", \"threads\": " << d.threads
+           << ", \"vocabulary\": " << d.vocabulary
+           << ", \"labels\": " << d.labels
+           << ", \"unique_words\": " << d.words
+           << ", \"correct\": " << d.correct
+           << ", \"model_bytes\": " << d.model_bytes;
+        if (d.pruned_vocabulary) {
+            os << ", \"pruned_vocabulary\": " << d.pruned_vocabulary
+               << ", \"pruned_model_bytes\": " << d.pruned_model_bytes
+               << ", \"pruned_correct\": " << d.pruned_correct;
+        }
+        os << ", \"stages\": [";
+        for (size_t j = 0; j < d.stages.size(); ++j) {
+            const Stage &s = d.stages[j];
+            os << (j ? ",\n" : "\n") << "    {\"name\": " << json_string(s.name)
+               << ", \"seconds\": " << s.seconds
+               << ", \"bytes\": " << s.bytes
+               << ", \"posts\": " << s.posts
+               << ", \"bytes_per_second\": " << double(s.bytes) / s.seconds
+               << ", \"posts_per_second\": " << double(s.posts) / s.seconds
+               << ", \"peak_rss_kb\": " << s.peak_rss_kb << "}";
+        }
+        os << "\n  ]}";
+    }
+    os << "\n]}\n";
+}
+
+int main(int argc, char *argv[]) {
+    string json_filename;
+    size_t threads = 1;
+    Pruning pruning;
+    int i = 1;
+    for (; i + 1 < argc && string(argv[i]).rfind("--", 0) == 0; i += 2) {
+        string flag = argv[i];
+        if (flag == "--json") json_filename = argv[i + 1];
+        else if (flag == "--threads") threads = strtoul(argv[i + 1], nullptr, 10);
+        else if (flag == "--min-count") pruning.min_count = strtoul(argv[i + 1], nullptr, 10);
+        else if (flag == "--max-vocab") pruning.max_vocab = strtoul(argv[i + 1], nullptr, 10);
+        else i = argc;
+    }
+    if (i >= argc || threads == 0) {
+        cout << "Usage: classifier_bench.exe [--threads N] [--json FILE] "
+             << "[--min-count N] [--max-vocab M] TRAIN_CSV[:TEST_CSV]..." << endl;
+        return 1;
+    }
+    cout << fixed << setprecision(1);
+
+    vector<Dataset> datasets;
+    try {
+        for (; i < argc; ++i) {
+            string arg = argv[i];
+            size_t colon = arg.find(':');
+            string train = arg.substr(0, colon);
+            string test = colon == string::npos ? train : arg.substr(colon + 1);
+            datasets.push_back(bench_dataset(train, test, threads, pruning));
+            print_table(datasets.back());
+        }
+    }
+    catch (const csvstream_exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    if (!json_filename.empty()) {
+        ofstream fout(json_filename);
+        write_json(fout, datasets);
+        if (!fout) {
+            cerr << "Error writing " << json_filename << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,475 @@
+/* -*- mode: c++ -*- */
+#ifndef CSVMMAP_HPP
+#define CSVMMAP_HPP
+/* csvmmap.hpp
+ *
+ * A zero-copy companion to csvstream.  The whole file is memory mapped and
+ * each row is returned as a vector of std::string_view fields that point
+ * directly into the mapping.  Quoting and backslash escapes follow exactly
+ * the same state machine as csvstream::read_csv_line(); csvscan lets it jump
+ * between the characters that can change state.  Large files are faulted in
+ * by a prefetch thread a few blocks in front of the parser.
+ *
+ * gzip and zstd files are decompressed on a thread as they are read instead
+ * of being mapped.  Only a window of the data around the current row is kept,
+ * so fields still stay valid until the next extraction, but split() is not
+ * available; see in_memory().
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "csvstream.hpp"
+#include "csvscan.hpp"
+#include "prefetcher.hpp"
+#include "decompressor.hpp"
+
+
+// Projected row whose fields point into the mapping
+typedef csvrow_basic<std::string_view> csvrow_view;
+
+// csvmmap interface
+class csvmmap {
+public:
+  // Constructor from filename. Throws csvstream_exception if open fails.
+  csvmmap(const std::string &filename, char delimiter=',', bool strict=true)
+    : filename(filename),
+      delimiter(delimiter),
+      scan(delimiter),
+      strict(strict),
+      line_no(0) {
+    map_file();
+    read_header();
+  }
+
+  // Constructor from filename, projecting each row onto the given columns.
+  // Throws csvstream_exception if open fails or a column is missing.
+  csvmmap(const std::string &filename, const std::vector<std::string> &columns,
+          char delimiter=',', bool strict=true)
+    : filename(filename),
+      delimiter(delimiter),
+      scan(delimiter),
+      strict(strict),
+      line_no(0),
+      columns(columns) {
+    map_file();
+    read_header();
+  }
+
+  // Destructor
+  ~csvmmap() {
+    prefetch.reset();
+    if (mapped) munmap(const_cast<char *>(base), size);
+  }
+
+  // Return false once every row has been extracted
+  explicit operator bool() const {
+    return good;
+  }
+
+  // Return header processed by constructor
+  std::vector<std::string> getheader() const {
+    return header;
+  }
+
+  // Return the position of a column in the header. Throws csvstream_exception
+  // if the header does not contain the column.
+  size_t column(const std::string &name) const {
+    for (size_t i=0; i<header.size(); ++i) {
+      if (header[i] == name) return i;
+    }
+    throw csvstream_exception("No column " + name + " in " + filename);
+  }
+
+  // Stream extraction operator reads one row, keeping column order.  Fields
+  // stay valid until the next extraction.  Throws csvstream_exception if the
+  // number of items in a row does not match the header.
+  csvmmap & operator>> (std::vector<std::string_view> &row) {
+    return extract_row(row);
+  }
+
+  // Stream extraction operator reads the projected columns of one row.  Only
+  // requested fields are looked at after tokenizing; no field is copied
+  // unless it has quotes to remove.  Throws csvstream_exception if the number
+  // of items in a row does not match the header.
+  csvmmap & operator>> (csvrow_view &row) {
+    return extract_row(row);
+  }
+
+  // Return true if the whole file is in memory, so fields stay valid as long
+  // as this reader and split() can be used.  False for compressed files.
+  bool in_memory() const {
+    return !inflater;
+  }
+
+  // Split the rows that have not been read yet into at most n shards of about
+  // equal size.  Shards are cut only at record boundaries, found by running
+  // the tokenizer over the data, so a quoted line ending never splits a row.
+  // Each shard reads from this object's mapping, which must outlive it.
+  // Afterwards this reader is at the end of the file.
+  std::vector<std::unique_ptr<csvmmap> > split(size_t n) {
+    assert(in_memory());
+    std::vector<std::unique_ptr<csvmmap> > shards;
+    std::vector<Span> scratch;
+    const size_t start = pos;
+    size_t begin = pos;
+    size_t begin_line = line_no;
+    for (size_t k=1; k<=n && begin < size; ++k) {
+      size_t target = start + (size - start) * k / n;
+      while (pos < target && read_csv_line(scratch)) ++line_no;
+      shards.emplace_back(new csvmmap(*this, begin, pos, begin_line));
+      begin = pos;
+      begin_line = line_no;
+    }
+    good = false;
+    return shards;
+  }
+
+private:
+  // Raw extent of one field, before quote characters are removed
+  struct Span {
+    size_t begin;
+    size_t end;
+    size_t quotes;      // number of quote characters that change state
+    size_t first_quote; // position of first such quote
+    size_t last_quote;  // position of last such quote
+  };
+
+  // Filename.  Used for error messages.
+  std::string filename;
+
+  // Delimiter between columns
+  char delimiter;
+
+  // Finds the next character that can change parser state
+  csvscan scan;
+
+  // Strictly enforce the number of values in each row.  When strict=false,
+  // ignore extra values and set missing values to empty string.
+  bool strict;
+
+  // Line no in file.  Used for error messages
+  size_t line_no;
+
+  // Mapped file contents.  Files that cannot be mapped (pipes, empty files)
+  // are read into fallback instead.
+  const char *base = nullptr;
+  size_t size = 0;
+  bool mapped = false;
+  std::string fallback;
+
+  // Prefetches the mapping ahead of pos, for files of more than one block.
+  // Shards read from several places at once and go without.
+  std::unique_ptr<prefetcher> prefetch;
+
+  // Decompresses a compressed file.  fallback then holds a window of the
+  // decompressed data: the row being read and the chunks after it.
+  std::unique_ptr<decompressor> inflater;
+  std::string chunk;
+
+  // Read position and stream status
+  size_t pos = 0;
+  bool good = true;
+
+  // Store header column names
+  std::vector<std::string> header;
+
+  // Columns requested by a projecting constructor, and the header position
+  // of each of them
+  std::vector<std::string> columns;
+  std::vector<size_t> index;
+
+  // Per-row scratch space, reused between rows
+  std::vector<Span> spans;
+  std::vector<std::string> copies;
+
+  // Disable copying because the object owns a mapping
+  csvmmap(const csvmmap &);
+  csvmmap & operator= (const csvmmap &);
+
+  // Shard of another reader's mapping, reading rows in [begin, end)
+  csvmmap(const csvmmap &whole, size_t begin, size_t end, size_t line_no)
+    : filename(whole.filename),
+      delimiter(whole.delimiter),
+      scan(whole.delimiter),
+      strict(whole.strict),
+      line_no(line_no),
+      base(whole.base),
+      size(end),
+      pos(begin),
+      header(whole.header),
+      columns(whole.columns),
+      index(whole.index) {}
+
+  /////////////////////////////////////////////////////////////////////////////
+  // Implementation
+
+  // Map the whole file read-only
+  void map_file() {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw csvstream_exception("Error opening file: " + filename);
+    }
+    struct stat st;
+    unsigned char magic[4];
+    ssize_t magic_size = pread(fd, magic, sizeof(magic), 0);
+    decompressor::format fmt =
+      decompressor::detect(magic, magic_size > 0 ? size_t(magic_size) : 0);
+    if (fmt != decompressor::PLAIN) {
+      close(fd);
+      inflater.reset(new decompressor(filename, fmt));
+      base = fallback.data();
+      return;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      size = static_cast<size_t>(st.st_size);
+      void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        base = static_cast<const char *>(p);
+        mapped = true;
+        madvise(p, size, MADV_SEQUENTIAL);
+        if (size > prefetcher::BLOCK) prefetch.reset(new prefetcher(base, size));
+      }
+    }
+    close(fd);
+    if (!mapped) {
+      std::ifstream fin(filename.c_str(), std::ios::binary);
+      std::ostringstream oss;
+      oss << fin.rdbuf();
+      fallback = oss.str();
+      base = fallback.data();
+      size = fallback.size();
+    }
+  }
+
+  // Tokenize one line starting at pos into spans
+  bool read_csv_line(std::vector<Span> &data) {
+    return inflater ? read_streamed_line(data) : tokenize_line(data);
+  }
+
+  // Tokenize one line of a compressed file.  A line that reaches the end of
+  // the data decompressed so far may go on in the next chunk, so it is read
+  // again once that chunk is in.
+  bool read_streamed_line(std::vector<Span> &data) {
+    size_t start = pos;
+    while (!tokenize_line(data) || pos == size) {
+      if (!next_chunk(start)) {
+        pos = start;
+        return tokenize_line(data);
+      }
+      start = pos = 0;
+    }
+    return true;
+  }
+
+  // Drop the data before keep and append the next decompressed chunk.
+  // Returns false at the end of the file.
+  bool next_chunk(size_t keep) {
+    if (!inflater->next(chunk)) return false;
+    fallback.erase(0, keep);
+    fallback += chunk;
+    base = fallback.data();
+    size = fallback.size();
+    return true;
+  }
+
+  // Tokenize one line starting at pos into spans.  Mirrors the state machine
+  // in csvstream::read_csv_line(), but records field extents instead of
+  // copying characters.
+  bool tokenize_line(std::vector<Span> &data) {
+    data.clear();
+    if (pos >= size) return false;
+    if (prefetch) prefetch->advance(pos);
+    data.push_back(Span{pos, pos, 0, 0, 0});
+
+    enum State {UNQUOTED, UNQUOTED_ESCAPED, QUOTED, QUOTED_ESCAPED};
+    State state = UNQUOTED;
+    while (pos < size) {
+      // Jump over characters that would only be appended to the field
+      if (state == UNQUOTED) {
+        pos = scan.next_unquoted(base + pos, base + size) - base;
+      } else if (state == QUOTED) {
+        pos = scan.next_quoted(base + pos, base + size) - base;
+      }
+      if (pos == size) break;
+
+      char c = base[pos];
+      switch (state) {
+      case UNQUOTED:
+        if (c == '"') {
+          note_quote(data.back(), pos);
+          state = QUOTED;
+        } else if (c == '\\') {
+          state = UNQUOTED_ESCAPED;
+        } else if (c == delimiter) {
+          data.back().end = pos;
+          data.push_back(Span{pos + 1, pos + 1, 0, 0, 0});
+        } else if (c == '\n' || c == '\r') {
+          // Consume the line ending, plus the second character of \r\n
+          data.back().end = pos++;
+          if (pos < size && base[pos] == '\n') ++pos;
+          return true;
+        }
+        break;
+
+      case UNQUOTED_ESCAPED:
+        state = UNQUOTED;
+        break;
+
+      case QUOTED:
+        if (c == '"') {
+          note_quote(data.back(), pos);
+          state = UNQUOTED;
+        } else if (c == '\\') {
+          state = QUOTED_ESCAPED;
+        }
+        break;
+
+      case QUOTED_ESCAPED:
+        state = QUOTED;
+        break;
+
+      default:
+        assert(0);
+        throw state;
+      }//switch
+      ++pos;
+    }//while
+
+    // Partial last line without a line ending
+    data.back().end = pos;
+    return true;
+  }
+
+  static void note_quote(Span &span, size_t at) {
+    if (span.quotes == 0) span.first_quote = at;
+    span.last_quote = at;
+    ++span.quotes;
+  }
+
+  // Turn a span into a field.  Only fields with quote characters somewhere
+  // other than their two ends need to be copied.
+  std::string_view field(const Span &s, std::string &copy) const {
+    size_t b = s.begin;
+    size_t e = s.end;
+    if (s.quotes == 0) return std::string_view(base + b, e - b);
+    if (s.first_quote == b) {
+      ++b;
+      if (s.quotes == 1) return std::string_view(base + b, e - b);
+      if (s.quotes == 2 && s.last_quote == e - 1) {
+        return std::string_view(base + b, e - 1 - b);
+      }
+      --b;
+    }
+
+    // Drop every quote that changes state; keep escapes verbatim
+    copy.clear();
+    bool escaped = false;
+    for (size_t i=b; i<e; ++i) {
+      char c = base[i];
+      if (escaped) {
+        escaped = false;
+      } else if (c == '\\') {
+        escaped = true;
+      } else if (c == '"') {
+        continue;
+      }
+      copy += c;
+    }
+    return copy;
+  }
+
+  // Process header, the first line of the file
+  void read_header() {
+    if (!read_csv_line(spans)) {
+      throw csvstream_exception("error reading header: " + filename);
+    }
+    std::string copy;
+    for (const Span &s : spans) {
+      header.push_back(std::string(field(s, copy)));
+    }
+
+    // Resolve projected column names to positions once
+    for (const std::string &name : columns) {
+      index.push_back(column(name));
+    }
+  }
+
+  // Check length of a tokenized row against the header
+  void check_size(size_t size) const {
+    if (size != header.size()) {
+      auto msg = "Number of items in row does not match header. " +
+        filename + ":L" + std::to_string(line_no) + " " +
+        "header.size() = " + std::to_string(header.size()) + " " +
+        "row.size() = " + std::to_string(size) + " "
+        ;
+      throw csvstream_exception(msg);
+    }
+  }
+
+  // Extract a row into a vector of fields
+  csvmmap & extract_row(std::vector<std::string_view> &row) {
+    // Clear input row
+    row.clear();
+
+    // Read one line, bail out if we're at the end
+    if (!read_csv_line(spans)) {
+      good = false;
+      return *this;
+    }
+    line_no += 1;
+
+    // When strict mode is disabled, coerce the length of the data.  If data is
+    // larger than header, discard extra values.  If data is smaller than header,
+    // pad data with empty strings.
+    if (!strict) {
+      spans.resize(header.size(), Span{pos, pos, 0, 0, 0});
+    }
+
+    // Check length of data
+    check_size(spans.size());
+
+    if (copies.size() < spans.size()) copies.resize(spans.size());
+    for (size_t i=0; i<spans.size(); ++i) {
+      row.push_back(field(spans[i], copies[i]));
+    }
+
+    return *this;
+  }
+
+  // Extract the projected columns of a row
+  csvmmap & extract_row(csvrow_view &row) {
+    row.fields.assign(columns.size(), std::string_view());
+
+    // Read one line, bail out if we're at the end
+    if (!read_csv_line(spans)) {
+      good = false;
+      return *this;
+    }
+    line_no += 1;
+
+    // Without strict mode, missing values stay empty and extra values are
+    // never looked at
+    if (strict) check_size(spans.size());
+
+    if (copies.size() < columns.size()) copies.resize(columns.size());
+    for (size_t i=0; i<columns.size(); ++i) {
+      if (index[i] < spans.size()) {
+        row.fields[i] = field(spans[index[i]], copies[i]);
+      }
+    }
+
+    return *this;
+  }
+};
+
+#endif
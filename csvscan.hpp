@@ -0,0 +1,159 @@
+/* -*- mode: c++ -*- */
+#ifndef CSVSCAN_HPP
+#define CSVSCAN_HPP
+/* csvscan.hpp
+ *
+ * Structural character scanner used by csvmmap.  Instead of stepping through
+ * a field one character at a time, the parser asks the scanner for the next
+ * byte that can change its state (delimiter, quote, backslash or line ending)
+ * and jumps straight to it.  Bytes are classified 32 (SSE2) or 64 (AVX2) at a
+ * time, with a table-driven scalar fallback.  The engine is picked at runtime
+ * from what the CPU supports.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#define CSVSCAN_X86 1
+#include <immintrin.h>
+#endif
+
+
+// csvscan interface
+class csvscan {
+public:
+  enum Engine {SCALAR, SSE2, AVX2};
+
+  // Scanner for the given delimiter, using the best engine for this CPU
+  explicit csvscan(char delimiter)
+    : csvscan(delimiter, best_engine()) {}
+
+  // Scanner for the given delimiter, using a specific engine.  Engines that
+  // are not available on this CPU degrade to the best available one.
+  csvscan(char delimiter, Engine engine)
+    : engine(engine > best_engine() ? best_engine() : engine),
+      unquoted{delimiter, '"', '\\', '\n', '\r'},
+      quoted{'"', '\\', '"', '"', '"'} {
+    build_table(unquoted, unquoted_table);
+    build_table(quoted, quoted_table);
+  }
+
+  // Return the first delimiter, quote, backslash or line ending in [p, end),
+  // or end if there is none
+  const char * next_unquoted(const char *p, const char *end) const {
+    return find(p, end, unquoted, unquoted_table);
+  }
+
+  // Return the first quote or backslash in [p, end), or end if there is none
+  const char * next_quoted(const char *p, const char *end) const {
+    return find(p, end, quoted, quoted_table);
+  }
+
+  // Engine in use
+  Engine get_engine() const {
+    return engine;
+  }
+
+  static const char * engine_name(Engine e) {
+    static const char *names[] = {"scalar", "sse2", "avx2"};
+    return names[e];
+  }
+
+  // Best engine supported by the running CPU
+  static Engine best_engine() {
+#if CSVSCAN_X86
+    static const Engine best =
+      __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+    return best;
+#else
+    return SCALAR;
+#endif
+  }
+
+private:
+  // Number of bytes in a character set.  Shorter sets repeat a member.
+  static const int SET_SIZE = 5;
+
+  Engine engine;
+  char unquoted[SET_SIZE];
+  char quoted[SET_SIZE];
+  bool unquoted_table[256];
+  bool quoted_table[256];
+
+  /////////////////////////////////////////////////////////////////////////////
+  // Implementation
+
+  static void build_table(const char *set, bool *table) {
+    std::memset(table, 0, 256 * sizeof(bool));
+    for (int i=0; i<SET_SIZE; ++i) {
+      table[static_cast<unsigned char>(set[i])] = true;
+    }
+  }
+
+  const char * find(const char *p, const char *end,
+                    const char *set, const bool *table) const {
+#if CSVSCAN_X86
+    if (engine == AVX2) p = find_avx2(p, end, set);
+    else if (engine == SSE2) p = find_sse2(p, end, set);
+#endif
+    return find_scalar(p, end, table);
+  }
+
+  static const char * find_scalar(const char *p, const char *end,
+                                  const bool *table) {
+    while (p < end && !table[static_cast<unsigned char>(*p)]) ++p;
+    return p;
+  }
+
+#if CSVSCAN_X86
+  // Skip whole 32-byte blocks without a match.  Stops at the block that
+  // contains one, or at the tail that is too short for a full block.
+  static const char * find_sse2(const char *p, const char *end,
+                                const char *set) {
+    __m128i needle[SET_SIZE];
+    for (int i=0; i<SET_SIZE; ++i) needle[i] = _mm_set1_epi8(set[i]);
+    while (end - p >= 32) {
+      __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16));
+      __m128i hit_lo = _mm_setzero_si128();
+      __m128i hit_hi = _mm_setzero_si128();
+      for (int i=0; i<SET_SIZE; ++i) {
+        hit_lo = _mm_or_si128(hit_lo, _mm_cmpeq_epi8(lo, needle[i]));
+        hit_hi = _mm_or_si128(hit_hi, _mm_cmpeq_epi8(hi, needle[i]));
+      }
+      uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit_lo)) |
+        (static_cast<uint32_t>(_mm_movemask_epi8(hit_hi)) << 16);
+      if (mask) return p + __builtin_ctz(mask);
+      p += 32;
+    }
+    return p;
+  }
+
+  // Same as find_sse2(), 64 bytes at a time
+  __attribute__((target("avx2")))
+  static const char * find_avx2(const char *p, const char *end,
+                                const char *set) {
+    __m256i needle[SET_SIZE];
+    for (int i=0; i<SET_SIZE; ++i) needle[i] = _mm256_set1_epi8(set[i]);
+    while (end - p >= 64) {
+      __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+      __m256i hit_lo = _mm256_setzero_si256();
+      __m256i hit_hi = _mm256_setzero_si256();
+      for (int i=0; i<SET_SIZE; ++i) {
+        hit_lo = _mm256_or_si256(hit_lo, _mm256_cmpeq_epi8(lo, needle[i]));
+        hit_hi = _mm256_or_si256(hit_hi, _mm256_cmpeq_epi8(hi, needle[i]));
+      }
+      uint32_t mask_lo = static_cast<uint32_t>(_mm256_movemask_epi8(hit_lo));
+      uint32_t mask_hi = static_cast<uint32_t>(_mm256_movemask_epi8(hit_hi));
+      uint64_t mask = mask_lo | (static_cast<uint64_t>(mask_hi) << 32);
+      if (mask) return p + __builtin_ctzll(mask);
+      p += 64;
+    }
+    return p;
+  }
+#endif
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include "csvstream.hpp"
+#include "csvmmap.hpp"
+#include "csvscan.hpp"
+
+using namespace std;
+
+/*
+ * Microbenchmark for csvscan and csvmmap.
+ *
+ * For each CSV file:
+ *   1) Checks that csvmmap yields byte-identical fields to csvstream's
+ *      character-at-a-time state machine, and that every scanner engine finds
+ *      the same structural characters as the scalar engine.
+ *   2) Reports throughput in GB/s of the raw scanner for each engine, and of
+ *      full row parsing with csvstream and with csvmmap.
+ * Exits with status 1 if any check fails.
+ */
+
+// Minimum wall time spent on each measurement
+const double MIN_SECONDS = 0.2;
+
+// Run body() until MIN_SECONDS have passed; return GB/s for `bytes` per run
+template <typename Body>
+static double gbps(size_t bytes, Body body) {
+    using clock = chrono::steady_clock;
+    size_t runs = 0;
+    auto start = clock::now();
+    double elapsed = 0.0;
+    do {
+        body();
+        ++runs;
+        elapsed = chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < MIN_SECONDS);
+    return double(bytes) * double(runs) / elapsed / 1e9;
+}
+
+// Walk a buffer the way the parser does: alternate between unquoted and
+// quoted scanning on every quote.  Returns the number of stops.
+static size_t walk(const csvscan &scan, const string &text, vector<size_t> *stops) {
+    const char *p = text.data();
+    const char *end = p + text.size();
+    bool quoted = false;
+    size_t count = 0;
+    while (p < end) {
+        p = quoted ? scan.next_quoted(p, end) : scan.next_unquoted(p, end);
+        if (p == end) break;
+        if (*p == '"') quoted = !quoted;
+        if (stops) stops->push_back(size_t(p - text.data()));
+        ++count;
+        ++p;
+    }
+    return count;
+}
+
+static size_t parse_csvstream(const string &filename) {
+    csvstream csvin(filename);
+    vector<pair<string, string>> row;
+    size_t rows = 0;
+    while (csvin >> row) ++rows;
+    return rows;
+}
+
+static size_t parse_csvmmap(const string &filename) {
+    csvmmap csvin(filename);
+    vector<string_view> row;
+    size_t rows = 0;
+    while (csvin >> row) ++rows;
+    return rows;
+}
+
+// Compare every field of every row read by csvstream and csvmmap
+static bool same_fields(const string &filename) {
+    csvstream expected(filename);
+    csvmmap actual(filename);
+    if (expected.getheader() != actual.getheader()) return false;
+    vector<pair<string, string>> want;
+    vector<string_view> got;
+    while (true) {
+        bool more = static_cast<bool>(expected >> want);
+        if (more != static_cast<bool>(actual >> got)) return false;
+        if (!more) return true;
+        for (size_t i = 0; i < want.size(); ++i) {
+            if (want[i].second != got[i]) return false;
+        }
+    }
+}
+
+static void report(const string &what, double rate) {
+    cout << "  " << left << setw(16) << what
+         << right << setw(8) << rate << " GB/s\n";
+}
+
+static bool bench_file(const string &filename) {
+    ifstream fin(filename, ios::binary);
+    ostringstream oss;
+    oss << fin.rdbuf();
+    const string text = oss.str();
+
+    vector<csvscan::Engine> engines;
+    for (int e = csvscan::SCALAR; e <= csvscan::best_engine(); ++e) {
+        engines.push_back(csvscan::Engine(e));
+    }
+
+    // 1) Correctness checks
+    bool ok = same_fields(filename);
+    vector<size_t> reference;
+    walk(csvscan(',', csvscan::SCALAR), text, &reference);
+    for (auto e : engines) {
+        vector<size_t> stops;
+        walk(csvscan(',', e), text, &stops);
+        ok = ok && stops == reference;
+    }
+
+    // 2) Throughput
+    cout << filename << " (" << text.size() << " bytes, "
+         << csvscan::engine_name(csvscan::best_engine()) << "): "
+         << (ok ? "fields identical" : "MISMATCH") << "\n";
+    for (auto e : engines) {
+        csvscan scan(',', e);
+        double rate = gbps(text.size(), [&] { walk(scan, text, nullptr); });
+        report("scan " + string(csvscan::engine_name(e)), rate);
+    }
+    report("parse csvstream",
+           gbps(text.size(), [&] { parse_csvstream(filename); }));
+    report("parse csvmmap",
+           gbps(text.size(), [&] { parse_csvmmap(filename); }));
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: csvscan_bench.exe CSV_FILE..." << endl;
+        return 1;
+    }
+    cout << fixed << setprecision(3);
+
+    bool ok = true;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            ok = bench_file(argv[i]) && ok;
+        }
+    }
+    catch (const csvstream_exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
@@ -31,6 +31,27 @@ public:
 };
 
 
+// A row restricted to the columns requested from a projecting reader.  Field
+// i holds the value of the i-th requested column.  The number of fields is
+// fixed when the reader resolves its projection, so extraction only reuses
+// the existing field storage.
+template <typename Field>
+class csvrow_basic {
+public:
+  const Field & operator[] (size_t i) const {
+    return fields[i];
+  }
+
+  size_t size() const {
+    return fields.size();
+  }
+
+  std::vector<Field> fields;
+};
+
+typedef csvrow_basic<std::string> csvrow;
+
+
 // csvstream interface
 class csvstream {
 public:
@@ -52,6 +73,27 @@ public:
     read_header();
   }
 
+  // Constructor from filename, projecting each row onto the given columns.
+  // Throws csvstream_exception if open fails or a column is missing.
+  csvstream(const std::string &filename, const std::vector<std::string> &columns,
+            char delimiter=',', bool strict=true)
+    : filename(filename),
+      is(fin),
+      delimiter(delimiter),
+      strict(strict),
+      line_no(0),
+      columns(columns) {
+
+    // Open file
+    fin.open(filename.c_str());
+    if (!fin.is_open()) {
+      throw csvstream_exception("Error opening file: " + filename);
+    }
+
+    // Process header
+    read_header();
+  }
+
   // Constructor from stream
   csvstream(std::istream &is, char delimiter=',', bool strict=true)
     : filename("[no filename]"),
@@ -62,6 +104,18 @@ public:
     read_header();
   }
 
+  // Constructor from stream, projecting each row onto the given columns
+  csvstream(std::istream &is, const std::vector<std::string> &columns,
+            char delimiter=',', bool strict=true)
+    : filename("[no filename]"),
+      is(is),
+      delimiter(delimiter),
+      strict(strict),
+      line_no(0),
+      columns(columns) {
+    read_header();
+  }
+
   // Destructor
   ~csvstream() {
     if (fin.is_open()) fin.close();
@@ -90,6 +144,14 @@ public:
     return extract_row(row);
   }
 
+  // Stream extraction operator reads the projected columns of one row.
+  // Unrequested fields are skipped without being stored.  Throws
+  // csvstream_exception if the number of items in a row does not match the
+  // header.
+  csvstream & operator>> (csvrow &row) {
+    return extract_row(row);
+  }
+
 private:
   // Filename.  Used for error messages.
   std::string filename;
@@ -114,6 +176,14 @@ private:
   // Store header column names
   std::vector<std::string> header;
 
+  // Columns requested by a projecting constructor, and for each header
+  // column its first position in the projected row (-1 if not requested).
+  // A column requested again is copied from its first position, as
+  // {position, first position} pairs in repeats.
+  std::vector<std::string> columns;
+  std::vector<int> slot;
+  std::vector<std::pair<size_t, size_t> > repeats;
+
   // Disable copying because copying streams is bad!
   csvstream(const csvstream &);
   csvstream & operator= (const csvstream &);
@@ -121,15 +191,57 @@ private:
   /////////////////////////////////////////////////////////////////////////////
   // Implementation
 
+  // Line tokenizer target that keeps every field
+  struct all_fields {
+    std::vector<std::string> &data;
+
+    void begin() {
+      data.clear();
+      data.push_back(std::string());
+    }
+    void append(char c) {
+      data.back() += c;
+    }
+    void next() {
+      data.push_back("");
+    }
+  };
+
+  // Line tokenizer target that keeps only projected fields.  Characters of
+  // any other field are dropped as they are read.
+  struct projected_fields {
+    const std::vector<int> &slot;
+    std::vector<std::string> &fields;
+    size_t count;
+    std::string *target;
+
+    void begin() {
+      for (std::string &f : fields) f.clear();
+      count = 0;
+      aim();
+    }
+    void append(char c) {
+      if (target) *target += c;
+    }
+    void next() {
+      ++count;
+      aim();
+    }
+    void aim() {
+      int i = count < slot.size() ? slot[count] : -1;
+      target = i < 0 ? nullptr : &fields[i];
+    }
+  };
+
   // Read and tokenize one line from a stream
+  template <typename Fields>
   static bool read_csv_line(std::istream &is,
-                            std::vector<std::string> &data,
+                            Fields &&data,
                             char delimiter
                             ) {
 
     // Add entry for first token, start with empty string
-    data.clear();
-    data.push_back(std::string());
+    data.begin();
 
     // Process one character at a time
     char c = '\0';
@@ -154,10 +266,10 @@ private:
           state = QUOTED;
         } else if (c == '\\') { //note this checks for a single backslash char
           state = UNQUOTED_ESCAPED;
-          data.back() += c;
+          data.append(c);
         } else if (c == delimiter) {
           // If you see a delimiter, then start a new field with an empty string
-          data.push_back("");
+          data.next();
         } else if (c == '\n' || c == '\r') {
           // If you see a line ending *and it's not within a quoted token*, stop
           // parsing the line.  Works for UNIX (\n) and OSX (\r) line endings.
@@ -165,13 +277,13 @@ private:
           state = END;
         } else {
           // Append character to current token
-          data.back() += c;
+          data.append(c);
         }
         break;
 
       case UNQUOTED_ESCAPED:
         // If a character is escaped, add it no matter what.
-        data.back() += c;
+        data.append(c);
         state = UNQUOTED;
         break;
 
@@ -181,16 +293,16 @@ private:
           state = UNQUOTED;
         } else if (c == '\\') {
           state = QUOTED_ESCAPED;
-          data.back() += c;
+          data.append(c);
         } else {
           // Append character to current token
-          data.back() += c;
+          data.append(c);
         }
         break;
 
       case QUOTED_ESCAPED:
         // If a character is escaped, add it no matter what.
-        data.back() += c;
+        data.append(c);
         state = QUOTED;
         break;
 
@@ -228,8 +340,21 @@ private:
   // Process header, the first line of the file
   void read_header() {
     // read first line, which is the header
-    if (!read_csv_line(is, header, delimiter)) {
-      throw csvstream_exception("error reading header");
+    if (!read_csv_line(is, all_fields{header}, delimiter)) {
+      throw csvstream_exception("error reading header: " + filename);
+    }
+
+    // Resolve projected column names to positions once
+    slot.assign(header.size(), -1);
+    repeats.clear();
+    for (size_t i=0; i<columns.size(); ++i) {
+      size_t j = 0;
+      while (j < header.size() && header[j] != columns[i]) ++j;
+      if (j == header.size()) {
+        throw csvstream_exception("No column " + columns[i] + " in " + filename);
+      }
+      if (slot[j] < 0) slot[j] = static_cast<int>(i);
+      else repeats.emplace_back(i, slot[j]);
     }
   }
 
@@ -240,7 +365,7 @@ private:
 
     // Read one line from stream, bail out if we're at the end
     std::vector<std::string> data;
-    if (!read_csv_line(is, data, delimiter)) return *this;
+    if (!read_csv_line(is, all_fields{data}, delimiter)) return *this;
     line_no += 1;
 
     // When strict mode is disabled, coerce the length of the data.  If data is
@@ -276,7 +401,7 @@ private:
 
     // Read one line from stream, bail out if we're at the end
     std::vector<std::string> data;
-    if (!read_csv_line(is, data, delimiter)) return *this;
+    if (!read_csv_line(is, all_fields{data}, delimiter)) return *this;
     line_no += 1;
 
     // When strict mode is disabled, coerce the length of the data.  If data is
@@ -303,6 +428,34 @@ private:
 
     return *this;
   }
+
+  // Extract the projected columns of a row
+  csvstream & extract_row(csvrow &row) {
+    row.fields.resize(columns.size());
+
+    // Read one line from stream, bail out if we're at the end
+    projected_fields data{slot, row.fields, 0, nullptr};
+    if (!read_csv_line(is, data, delimiter)) return *this;
+    line_no += 1;
+
+    // Check length of data.  Without strict mode, missing values are already
+    // empty and extra values were never stored.
+    size_t size = data.count + 1;
+    if (strict && size != header.size()) {
+      auto msg = "Number of items in row does not match header. " +
+        filename + ":L" + std::to_string(line_no) + " " +
+        "header.size() = " + std::to_string(header.size()) + " " +
+        "row.size() = " + std::to_string(size) + " "
+        ;
+      throw csvstream_exception(msg);
+    }
+
+    for (const auto &r : repeats) {
+      row.fields[r.first] = row.fields[r.second];
+    }
+
+    return *this;
+  }
 };
 
 #endif
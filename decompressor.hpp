@@ -0,0 +1,189 @@
+#ifndef DECOMPRESSOR_HPP
+#define DECOMPRESSOR_HPP
+/* decompressor.hpp
+ *
+ * Streaming decompression of gzip and zstd files.  A thread decompresses
+ * the file into chunks of CHUNK bytes and hands them over through a queue of
+ * at most CHUNKS_AHEAD chunks, so decompression overlaps with whatever the
+ * reader does with the data, and memory stays bounded however large the
+ * file is.
+ *
+ * gzip needs zlib and zstd needs libzstd; a format whose header is not
+ * installed is reported as unsupported when a file in it is opened.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "work_queue.hpp"
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define DECOMPRESSOR_GZIP 1
+#else
+#define DECOMPRESSOR_GZIP 0
+#endif
+
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define DECOMPRESSOR_ZSTD 1
+#else
+#define DECOMPRESSOR_ZSTD 0
+#endif
+
+// Thrown for compressed files that cannot be read
+class decompressor_error : public std::runtime_error {
+public:
+    explicit decompressor_error(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+class decompressor {
+public:
+    static constexpr size_t CHUNK = size_t(1) << 20;
+    static constexpr size_t CHUNKS_AHEAD = 4;
+
+    enum format { PLAIN, GZIP, ZSTD };
+
+    // Format of a file that starts with the given bytes
+    static format detect(const unsigned char *magic, size_t n) {
+        static const unsigned char GZIP_MAGIC[] = {0x1f, 0x8b};
+        static const unsigned char ZSTD_MAGIC[] = {0x28, 0xb5, 0x2f, 0xfd};
+        if (n >= sizeof(GZIP_MAGIC) &&
+            std::memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)) == 0) {
+            return GZIP;
+        }
+        if (n >= sizeof(ZSTD_MAGIC) &&
+            std::memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)) == 0) {
+            return ZSTD;
+        }
+        return PLAIN;
+    }
+
+    // Start decompressing a file in the given format.  Throws
+    // decompressor_error if the format is not supported.
+    decompressor(const std::string &filename, format fmt)
+        : filename(filename), chunks(CHUNKS_AHEAD) {
+        if ((fmt == GZIP && !DECOMPRESSOR_GZIP) || (fmt == ZSTD && !DECOMPRESSOR_ZSTD) ||
+            fmt == PLAIN) {
+            fail("compression format not supported by this build");
+        }
+        worker = std::thread([this, fmt]() {
+            try {
+                if (fmt == GZIP) inflate_gzip();
+                else inflate_zstd();
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            chunks.close();
+        });
+    }
+
+    // Stop decompressing, even if the reader did not get to the end
+    ~decompressor() {
+        chunks.close();
+        worker.join();
+    }
+
+    decompressor(const decompressor &) = delete;
+    decompressor & operator= (const decompressor &) = delete;
+
+    // Replace chunk with the next decompressed data.  Returns false at the
+    // end of the file; throws decompressor_error if the file is damaged,
+    // or whatever else stopped the worker, such as std::bad_alloc.
+    bool next(std::string &chunk) {
+        if (chunks.pop(chunk)) return true;
+        if (error) std::rethrow_exception(error);
+        return false;
+    }
+
+private:
+    std::string filename;
+    work_queue<std::string> chunks;
+    std::exception_ptr error;   // set by the worker before it closes chunks
+    std::thread worker;
+
+    [[noreturn]] void fail(const std::string &why) const {
+        throw decompressor_error("Error decompressing file: " + filename + ": " + why);
+    }
+
+    // Pass a full chunk on.  Returns false once the reader has gone away.
+    bool emit(std::string &chunk) {
+        if (chunk.empty()) return true;
+        bool open = chunks.push(std::move(chunk));
+        chunk = std::string();
+        chunk.reserve(CHUNK);
+        return open;
+    }
+
+    void inflate_gzip() {
+#if DECOMPRESSOR_GZIP
+        gzFile in = gzopen(filename.c_str(), "rb");
+        if (!in) fail("cannot open");
+        gzbuffer(in, 1 << 18);
+        std::string chunk(CHUNK, '\0');
+        while (true) {
+            // A truncated file reads as a short one, with the error left
+            // for gzerror()
+            int n = gzread(in, &chunk[0], static_cast<unsigned>(CHUNK));
+            int code = Z_OK;
+            std::string why = gzerror(in, &code);
+            if (n < 0 || (n == 0 && code != Z_OK)) {
+                gzclose(in);
+                // why names the file
+                throw decompressor_error("Error decompressing file: " + why);
+            }
+            if (n == 0) break;
+            chunk.resize(static_cast<size_t>(n));
+            if (!emit(chunk)) break;
+            chunk.resize(CHUNK);
+        }
+        gzclose(in);
+#endif
+    }
+
+    void inflate_zstd() {
+#if DECOMPRESSOR_ZSTD
+        std::FILE *in = std::fopen(filename.c_str(), "rb");
+        if (!in) fail("cannot open");
+        ZSTD_DCtx *ctx = ZSTD_createDCtx();
+        std::string input(ZSTD_DStreamInSize(), '\0');
+        std::string chunk(CHUNK, '\0');
+        ZSTD_outBuffer out = {&chunk[0], CHUNK, 0};
+        size_t last = 0;        // 0 once the last frame is complete
+        bool open = true;
+        size_t n;
+        while (open && (n = std::fread(&input[0], 1, input.size(), in)) > 0) {
+            // A full chunk may leave output behind, so go on until the
+            // input is used up and the chunk has room left
+            ZSTD_inBuffer buffer = {input.data(), n, 0};
+            bool full;
+            do {
+                last = ZSTD_decompressStream(ctx, &out, &buffer);
+                if (ZSTD_isError(last)) {
+                    std::string why = ZSTD_getErrorName(last);
+                    ZSTD_freeDCtx(ctx);
+                    std::fclose(in);
+                    fail(why);
+                }
+                full = out.pos == out.size;
+                if (full) {
+                    open = emit(chunk);
+                    chunk.resize(CHUNK);
+                    out = {&chunk[0], CHUNK, 0};
+                }
+            } while (open && (buffer.pos < buffer.size || full));
+        }
+        ZSTD_freeDCtx(ctx);
+        std::fclose(in);
+        if (open && last != 0) fail("truncated file");
+        chunk.resize(out.pos);
+        emit(chunk);
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+using namespace std;
+
+/*
+ * Synthetic corpus generator for benchmarks.
+ *
+ * Writes a CSV file with "tag" and "content" columns to stdout.  Words are
+ * drawn from a Zipfian distribution over the vocabulary, so a few words are
+ * very common and most are rare, as in real posts.  Half of each post's words
+ * come from the shared ranking and half from a ranking rotated per label,
+ * which gives every label its own typical words.
+ *
+ * The output depends only on the options: the random engine is fully
+ * specified by the standard, and sampling does not use the
+ * implementation-defined std:: distributions.
+ */
+
+struct Options {
+    uint64_t posts = 100000;     // --posts N
+    uint64_t labels = 20;        // --labels N
+    uint64_t vocabulary = 50000; // --vocabulary N
+    uint64_t words = 40;         // --words N, average words per post
+    double skew = 1.0;           // --skew S, Zipf exponent
+    uint64_t seed = 280;         // --seed N
+};
+
+const char USAGE[] =
+    "Usage: gen_corpus.exe [--posts N] [--labels N] [--vocabulary N]\n"
+    "                      [--words N] [--skew S] [--seed N] > CORPUS.csv";
+
+// Uniform double in [0, 1) from the top 53 bits of the engine's output
+static double uniform(mt19937_64 &rng) {
+    return double(rng() >> 11) * 0x1.0p-53;
+}
+
+// Cumulative Zipf weights for ranks 1..n, normalized so the last is 1
+static vector<double> zipf_cdf(uint64_t n, double skew) {
+    vector<double> cdf(n);
+    double total = 0.0;
+    for (uint64_t rank = 0; rank < n; ++rank) {
+        total += 1.0 / pow(double(rank + 1), skew);
+        cdf[rank] = total;
+    }
+    for (double &c : cdf) c /= total;
+    return cdf;
+}
+
+// Rank drawn from cdf, 0 being the most common
+static uint64_t sample(const vector<double> &cdf, mt19937_64 &rng) {
+    auto it = upper_bound(cdf.begin(), cdf.end(), uniform(rng));
+    return min(uint64_t(it - cdf.begin()), uint64_t(cdf.size() - 1));
+}
+
+static bool parse_options(int argc, char *argv[], Options &opts) {
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) return false;
+        string flag = argv[i];
+        char *end = nullptr;
+        if (flag == "--skew") {
+            opts.skew = strtod(argv[i + 1], &end);
+            if (*end != '\0' || opts.skew <= 0.0) return false;
+            continue;
+        }
+        unsigned long long value = strtoull(argv[i + 1], &end, 10);
+        if (end == argv[i + 1] || *end != '\0') return false;
+        if (flag == "--posts") opts.posts = value;
+        else if (flag == "--labels") opts.labels = value;
+        else if (flag == "--vocabulary") opts.vocabulary = value;
+        else if (flag == "--words") opts.words = value;
+        else if (flag == "--seed") opts.seed = value;
+        else return false;
+    }
+    return opts.labels > 0 && opts.vocabulary > 0 && opts.words > 0;
+}
+
+int main(int argc, char *argv[]) {
+    Options opts;
+    if (!parse_options(argc, argv, opts)) {
+        cerr << USAGE << endl;
+        return 1;
+    }
+
+    ios_base::sync_with_stdio(false);
+    mt19937_64 rng(opts.seed);
+    vector<double> word_cdf = zipf_cdf(opts.vocabulary, opts.skew);
+    vector<double> label_cdf = zipf_cdf(opts.labels, opts.skew);
+    uint64_t rotation = max<uint64_t>(1, opts.vocabulary / opts.labels);
+
+    string line;
+    cout << "tag,content\n";
+    for (uint64_t post = 0; post < opts.posts; ++post) {
+        uint64_t label = sample(label_cdf, rng);
+        uint64_t length = 1 + uint64_t(uniform(rng) * double(2 * opts.words - 1));
+
+        line = "label" + to_string(label) + ",";
+        for (uint64_t i = 0; i < length; ++i) {
+            uint64_t rank = sample(word_cdf, rng);
+            if (rng() & 1) rank = (rank + label * rotation) % opts.vocabulary;
+            if (i > 0) line += ' ';
+            line += 'w';
+            line += to_string(rank);
+        }
+        line += '\n';
+        cout << line;
+    }
+    return cout ? 0 : 1;
+}
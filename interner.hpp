@@ -0,0 +1,150 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+/* interner.hpp
+ *
+ * Assigns each distinct string a dense integer ID, in order of first
+ * appearance.  String bytes live back to back in one arena; lookups go
+ * through an open-addressing hash table (linear probing) of IDs.  All state
+ * is kept in flat arrays, so an interner can be used directly from a mapped
+ * model file.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "mapped_vector.hpp"
+
+class interner {
+public:
+    // Returned by find() for strings that were never interned
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    interner() : slots(MIN_SLOTS, EMPTY) {}
+
+    // Interner whose arrays are allocated from memory
+    explicit interner(std::pmr::memory_resource *memory)
+        : arena(memory), offsets(memory), hashes(memory),
+          slots(MIN_SLOTS, EMPTY, memory) {}
+
+    // Return the ID of s, assigning the next free ID if s is new
+    uint32_t intern(std::string_view s) {
+        uint32_t h = hash(s);
+        size_t i = probe(s, h);
+        // Read through const, so looking up a string leaves borrowed
+        // arrays borrowed
+        const mapped_vector<uint32_t> &table = slots;
+        if (table[i] != EMPTY) return table[i];
+
+        uint32_t id = static_cast<uint32_t>(hashes.size());
+        arena.append(s.begin(), s.end());
+        offsets.push_back(static_cast<uint32_t>(arena.size()));
+        hashes.push_back(h);
+        slots[i] = id;
+        if (2 * hashes.size() > slots.size()) grow();
+        return id;
+    }
+
+    // Return the ID of s, or NONE
+    uint32_t find(std::string_view s) const {
+        return slots[probe(s, hash(s))];
+    }
+
+    // Return the string with the given ID.  The view is invalidated by the
+    // next call to intern().
+    std::string_view str(uint32_t id) const {
+        uint32_t begin = id == 0 ? 0 : offsets[id - 1];
+        return std::string_view(arena.data() + begin, offsets[id] - begin);
+    }
+
+    // Number of distinct strings
+    size_t size() const {
+        return hashes.size();
+    }
+
+    // Bytes held by all arrays
+    size_t bytes() const {
+        size_t total = 0;
+        arrays([&](const auto &array) { total += array.size() * sizeof(*array.data()); });
+        return total;
+    }
+
+    // Check that the arrays describe a valid table, as they always do unless
+    // they were mapped from a damaged model file
+    bool consistent() const {
+        size_t n = hashes.size();
+        if (offsets.size() != n || slots.empty() || slots.size() < 2 * n ||
+            (slots.size() & (slots.size() - 1)) != 0) {
+            return false;
+        }
+        for (size_t id = 0; id < n; ++id) {
+            uint32_t begin = id == 0 ? 0 : offsets[id - 1];
+            if (offsets[id] < begin || offsets[id] > arena.size()) return false;
+        }
+        // probe() stops only at the string or an empty slot
+        bool any_empty = false;
+        for (uint32_t id : slots) {
+            if (id == EMPTY) any_empty = true;
+            else if (id >= n) return false;
+        }
+        return any_empty;
+    }
+
+    // Apply f to each stored array, always in the same order.  Used to write
+    // and map model files.
+    template <typename F>
+    void arrays(F &&f) {
+        f(arena);
+        f(offsets);
+        f(hashes);
+        f(slots);
+    }
+    template <typename F>
+    void arrays(F &&f) const {
+        f(arena);
+        f(offsets);
+        f(hashes);
+        f(slots);
+    }
+
+private:
+    static constexpr uint32_t EMPTY = NONE;
+    static constexpr size_t MIN_SLOTS = 64;
+
+    mapped_vector<char> arena;       // string bytes, in ID order
+    mapped_vector<uint32_t> offsets; // end of each string in arena
+    mapped_vector<uint32_t> hashes;  // hash of each string
+    mapped_vector<uint32_t> slots;   // hash table of IDs; size is a power of 2
+
+    // FNV-1a
+    static uint32_t hash(std::string_view s) {
+        uint32_t h = 2166136261u;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    // Return the slot holding s, or the empty slot where it belongs
+    size_t probe(std::string_view s, uint32_t h) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask; ; i = (i + 1) & mask) {
+            uint32_t id = slots[i];
+            if (id == EMPTY || (hashes[id] == h && str(id) == s)) return i;
+        }
+    }
+
+    // Double the table, keeping the load factor at or below 1/2
+    void grow() {
+        slots.assign(slots.size() * 2, EMPTY);
+        size_t mask = slots.size() - 1;
+        for (uint32_t id = 0; id < hashes.size(); ++id) {
+            size_t i = hashes[id] & mask;
+            while (slots[i] != EMPTY) i = (i + 1) & mask;
+            slots[i] = id;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef MAPPED_VECTOR_HPP
+#define MAPPED_VECTOR_HPP
+/* mapped_vector.hpp
+ *
+ * Storage for model arrays that may live in a memory-mapped model file.
+ */
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Array that either owns its elements or borrows them from a mapped model
+ * file or a shared block.  Reads work the same either way; the first
+ * mutation of a borrowed array copies it into owned storage.  Owned storage comes from a
+ * std::pmr::memory_resource, so a whole model can share one arena.
+ */
+template <typename T>
+class mapped_vector {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "model arrays hold plain values");
+public:
+    using allocator_type = std::pmr::polymorphic_allocator<T>;
+
+    mapped_vector() = default;
+    explicit mapped_vector(const allocator_type &alloc) : owned(alloc) {}
+    mapped_vector(size_t n, const T &value, const allocator_type &alloc = {})
+        : owned(n, value, alloc) {}
+    mapped_vector(const mapped_vector &other, const allocator_type &alloc)
+        : owned(other.owned, alloc), view(other.view), view_size(other.view_size),
+          borrowed(other.borrowed), keeper(other.keeper) {}
+    mapped_vector(mapped_vector &&other, const allocator_type &alloc)
+        : owned(std::move(other.owned), alloc), view(other.view),
+          view_size(other.view_size), borrowed(other.borrowed),
+          keeper(std::move(other.keeper)) {}
+    mapped_vector(const mapped_vector &) = default;
+    mapped_vector(mapped_vector &&) = default;
+    mapped_vector & operator= (const mapped_vector &) = default;
+    mapped_vector & operator= (mapped_vector &&) = default;
+
+    allocator_type get_allocator() const { return owned.get_allocator(); }
+
+    // Use n elements owned by someone else, who must keep them alive, or
+    // who is kept alive by keeper for as long as they are borrowed
+    void borrow(const T *elems, size_t n, std::shared_ptr<const void> keeper = nullptr) {
+        owned.clear();
+        view = elems;
+        view_size = n;
+        borrowed = true;
+        this->keeper = std::move(keeper);
+    }
+
+    bool is_borrowed() const { return borrowed; }
+    size_t size() const { return borrowed ? view_size : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T * data() const { return borrowed ? view : owned.data(); }
+    const T * begin() const { return data(); }
+    const T * end() const { return data() + size(); }
+    const T & operator[] (size_t i) const { return data()[i]; }
+
+    T & operator[] (size_t i) {
+        own();
+        return owned[i];
+    }
+    void push_back(const T &value) {
+        own();
+        owned.push_back(value);
+    }
+    template <typename It>
+    void append(It first, It last) {
+        own();
+        owned.insert(owned.end(), first, last);
+    }
+    void resize(size_t n) {
+        own();
+        owned.resize(n);
+    }
+    void resize(size_t n, const T &value) {
+        own();
+        owned.resize(n, value);
+    }
+    void assign(size_t n, const T &value) {
+        borrowed = false;
+        keeper.reset();
+        owned.assign(n, value);
+    }
+
+private:
+    std::pmr::vector<T> owned;
+    const T *view = nullptr;
+    size_t view_size = 0;
+    bool borrowed = false;
+    std::shared_ptr<const void> keeper;
+
+    void own() {
+        if (!borrowed) return;
+        owned.assign(view, view + view_size);
+        borrowed = false;
+        keeper.reset();
+    }
+};
+
+#endif
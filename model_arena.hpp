@@ -0,0 +1,96 @@
+#ifndef MODEL_ARENA_HPP
+#define MODEL_ARENA_HPP
+/* model_arena.hpp
+ *
+ * Memory resource for the arrays of one model.  Every array is carved out
+ * of a few large blocks, and all of them are released at once with the
+ * arena.  Model arrays grow by doubling, so an arena that never reused
+ * memory would strand every outgrown copy of its arrays, and every array
+ * that compile() or prune() replaces.  Arrays are therefore rounded up to a
+ * power of two, and one that is freed goes on a free list for its size,
+ * from which the next array of that size takes it.  A large one also gives
+ * its pages back to the system first, so a stranded large array costs
+ * address space, not memory, as does the part of one past its size.
+ *
+ * Like std::pmr::monotonic_buffer_resource, an arena is not thread safe.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class model_arena : public std::pmr::memory_resource {
+public:
+    // Freed allocations of at least this many bytes give their pages back
+    static constexpr size_t LARGE = 4096;
+
+    explicit model_arena(std::pmr::memory_resource *upstream =
+                             std::pmr::get_default_resource())
+        : blocks(LARGE, upstream) {}
+
+    model_arena(const model_arena &) = delete;
+    model_arena & operator= (const model_arena &) = delete;
+
+private:
+    // A freed large allocation, linked through its first bytes
+    struct free_block {
+        free_block *next;
+    };
+
+    std::pmr::monotonic_buffer_resource blocks;
+    // Free allocations of 2^k bytes, by k
+    free_block *free_lists[std::numeric_limits<size_t>::digits] = {};
+
+    // Over-aligned allocations are only released with the arena
+    static bool recycled(size_t alignment) {
+        return alignment <= alignof(std::max_align_t);
+    }
+
+    // Smallest k with 2^k >= bytes, and room for a free_block
+    static size_t size_class(size_t bytes) {
+        size_t k = 0;
+        while ((size_t(1) << k) < std::max(bytes, sizeof(free_block))) ++k;
+        return k;
+    }
+
+    // Let the system reclaim the whole pages of a freed block, which read
+    // as zeros if it is used again.  The first bytes hold the free list.
+    static void release_pages(char *block, size_t bytes) {
+        uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t begin = reinterpret_cast<uintptr_t>(block + sizeof(free_block));
+        uintptr_t end = reinterpret_cast<uintptr_t>(block + bytes) & ~(page - 1);
+        begin = (begin + page - 1) & ~(page - 1);
+        if (begin < end) {
+            madvise(reinterpret_cast<void *>(begin), end - begin, MADV_DONTNEED);
+        }
+    }
+
+    void * do_allocate(size_t bytes, size_t alignment) override {
+        if (!recycled(alignment)) return blocks.allocate(bytes, alignment);
+        size_t k = size_class(bytes);
+        if (free_block *block = free_lists[k]) {
+            free_lists[k] = block->next;
+            return block;
+        }
+        size_t size = size_t(1) << k;
+        return blocks.allocate(size, std::min(size, alignof(std::max_align_t)));
+    }
+
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        if (!recycled(alignment)) return;
+        size_t k = size_class(bytes);
+        if (bytes >= LARGE) release_pages(static_cast<char *>(p), size_t(1) << k);
+        free_lists[k] = new (p) free_block{free_lists[k]};
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef MODEL_FILE_HPP
+#define MODEL_FILE_HPP
+/* model_file.hpp
+ *
+ * Binary model files.  A model file is a fixed header followed by a list of
+ * sections, each holding one flat array of plain values.  Sections start on
+ * 8-byte boundaries, so a loaded model uses its arrays straight out of the
+ * memory-mapped file instead of deserializing them.
+ *
+ * Layout (native byte order, checked on load):
+ *   ModelHeader
+ *   for each section: SectionHeader, count * elem_size bytes, zero padding
+ *
+ * Version 1 headers, from before hashed models, lack hash_bits and are read
+ * as unhashed models.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_vector.hpp"
+
+// Thrown for model files that cannot be written, read or understood
+class model_file_error : public std::runtime_error {
+public:
+    explicit model_file_error(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+// Identifies the file type and layout version
+struct ModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;    // BYTE_ORDER_MARK as written by the producer
+    int64_t total_posts;
+    uint64_t num_sections;
+    uint32_t hash_bits;     // words hashed into 2^hash_bits buckets, or 0
+    uint32_t reserved;
+};
+
+// Version 1 headers end before hash_bits
+const size_t MODEL_HEADER_V1_SIZE = offsetof(ModelHeader, hash_bits);
+
+struct SectionHeader {
+    uint64_t elem_size;
+    uint64_t count;
+};
+
+const char MODEL_MAGIC[8] = {'N', 'B', 'M', 'O', 'D', 'E', 'L', '\0'};
+const uint32_t MODEL_VERSION = 2;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// Writes a model file one section at a time
+class model_writer {
+public:
+    model_writer(const std::string &filename, int64_t total_posts,
+                 uint64_t num_sections, uint32_t hash_bits = 0)
+        : filename(filename), out(filename, std::ios::binary) {
+        if (!out) throw model_file_error("Error writing model file: " + filename);
+        ModelHeader header;
+        std::memcpy(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC));
+        header.version = MODEL_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.total_posts = total_posts;
+        header.num_sections = num_sections;
+        header.hash_bits = hash_bits;
+        header.reserved = 0;
+        write(&header, sizeof(header));
+    }
+
+    template <typename T>
+    void section(const mapped_vector<T> &array) {
+        SectionHeader header = {sizeof(T), array.size()};
+        write(&header, sizeof(header));
+        write(array.data(), array.size() * sizeof(T));
+        static const char zeros[8] = {};
+        write(zeros, (8 - array.size() * sizeof(T) % 8) % 8);
+    }
+
+    void close() {
+        out.close();
+        if (!out) throw model_file_error("Error writing model file: " + filename);
+    }
+
+private:
+    std::string filename;
+    std::ofstream out;
+
+    void write(const void *bytes, size_t n) {
+        out.write(static_cast<const char *>(bytes), static_cast<std::streamsize>(n));
+    }
+};
+
+// A whole file mapped read-only, unmapped when destroyed
+class file_mapping {
+public:
+    // Map filename, or leave base null if it is empty or cannot be mapped.
+    // Throws model_file_error if it cannot be opened.
+    explicit file_mapping(const std::string &filename) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw model_file_error("Error opening file: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size = static_cast<size_t>(st.st_size);
+            base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) base = nullptr;
+        }
+        close(fd);
+    }
+
+    ~file_mapping() {
+        if (base) munmap(base, size);
+    }
+
+    file_mapping(const file_mapping &) = delete;
+    file_mapping & operator= (const file_mapping &) = delete;
+
+    void *base = nullptr;
+    size_t size = 0;
+};
+
+// Maps a model file and hands out its sections in order
+class model_reader {
+public:
+    // The mapping is a member, so it is released even if the header fails
+    // to validate
+    explicit model_reader(const std::string &filename)
+        : filename(filename), mapping(filename), base(mapping.base), size(mapping.size) {
+        if (!base) fail("cannot map file");
+        if (size < MODEL_HEADER_V1_SIZE) fail("truncated header");
+        header = ModelHeader();
+        std::memcpy(&header, base, MODEL_HEADER_V1_SIZE);
+        if (std::memcmp(header.magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0) {
+            fail("not a model file");
+        }
+        if (header.byte_order != BYTE_ORDER_MARK) fail("wrong byte order");
+        if (header.version == 1) {
+            pos = MODEL_HEADER_V1_SIZE;
+            return;
+        }
+        if (header.version != MODEL_VERSION) fail("unsupported version");
+        if (size < sizeof(ModelHeader)) fail("truncated header");
+        std::memcpy(&header, base, sizeof(header));
+        pos = sizeof(header);
+    }
+
+    model_reader(const model_reader &) = delete;
+    model_reader & operator= (const model_reader &) = delete;
+
+    int64_t total_posts() const { return header.total_posts; }
+    uint64_t num_sections() const { return header.num_sections; }
+    uint32_t hash_bits() const { return header.hash_bits; }
+
+    // Point array at the next section
+    template <typename T>
+    void section(mapped_vector<T> &array) {
+        SectionHeader sh;
+        if (size - pos < sizeof(sh)) fail("truncated section");
+        std::memcpy(&sh, static_cast<const char *>(base) + pos, sizeof(sh));
+        pos += sizeof(sh);
+        if (sh.elem_size != sizeof(T)) fail("section has wrong element size");
+        if (sh.count > (size - pos) / sizeof(T)) fail("truncated section");
+        const char *data = static_cast<const char *>(base) + pos;
+        array.borrow(reinterpret_cast<const T *>(data), sh.count);
+        pos = std::min(size, pos + (sh.count * sizeof(T) + 7) / 8 * 8);
+    }
+
+private:
+    std::string filename;
+    file_mapping mapping;
+    const void *base;
+    size_t size;
+    size_t pos = 0;
+    ModelHeader header;
+
+    [[noreturn]] void fail(const std::string &why) const {
+        throw model_file_error("Error reading model file: " + filename + ": " + why);
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef MODEL_SNAPSHOTS_HPP
+#define MODEL_SNAPSHOTS_HPP
+/* model_snapshots.hpp
+ *
+ * A model that keeps answering predictions while new posts are counted into
+ * it.  Readers predict from immutable, reference-counted snapshots of the
+ * compiled model and never wait for an update.  The writer changes a copy
+ * of its own, then publishes a new snapshot with one atomic store; readers
+ * move to it the next time they ask, and the old snapshot is freed once its
+ * last reader lets go.
+ *
+ * The snapshot pointer is read and written with std::atomic_load/store,
+ * which are not lock-free in C++17 standard libraries: libstdc++ guards the
+ * pointer with a mutex from a small shared pool, held while the reference
+ * count is bumped.  Readers only take it when the version counter says
+ * there is a newer snapshot, and then wait at most for another thread's
+ * pointer copy, never for an update to be counted or compiled.
+ *
+ * Snapshots share every count and string array, and every block of rows of
+ * the compiled table, that a batch left unchanged (see
+ * Classifier::share_counts()).  A batch copies only the count rows of its
+ * labels and the table blocks of its words, plus the word counts and the
+ * small per-word and per-label arrays.  The quantized table and the
+ * inverted index, if on, are rebuilt and copied whole.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "classifier.hpp"
+
+class model_snapshots {
+public:
+    using snapshot = std::shared_ptr<const Classifier>;
+
+    // Start with a snapshot of a copy of trained, which must be compiled
+    explicit model_snapshots(const Classifier &trained) : model(trained) {
+        publish();
+    }
+
+    model_snapshots(const model_snapshots &) = delete;
+    model_snapshots & operator= (const model_snapshots &) = delete;
+
+    // The newest snapshot, which stays valid for as long as it is held
+    snapshot current() const {
+        return std::atomic_load(&published);
+    }
+
+    // Number of snapshots published so far, including the first
+    uint64_t version() const {
+        return versions.load(std::memory_order_acquire);
+    }
+
+    // Apply change(Classifier &) to the writer's copy of the model, such as
+    // counting a batch of posts with add_posts() or add_post(), then bring
+    // its compiled tables up to date with refresh() and publish it.  One
+    // update runs at a time; readers carry on with the previous snapshot.
+    template <typename Change>
+    void update(Change &&change) {
+        std::lock_guard<std::mutex> lock(writer);
+        change(model);
+        model.refresh();
+        publish();
+    }
+
+    // A reader's handle on the newest snapshot.  It keeps its snapshot until
+    // a newer one is published, so most calls to model() only read the
+    // version counter.  Each thread needs its own reader.
+    class reader {
+    public:
+        explicit reader(const model_snapshots &snapshots) : snapshots(snapshots) {}
+
+        // The newest snapshot; the reference is valid until the next call
+        const Classifier & model() {
+            uint64_t newest = snapshots.version();
+            if (newest != seen) {
+                held = snapshots.current();
+                seen = newest;
+            }
+            return *held;
+        }
+
+    private:
+        const model_snapshots &snapshots;
+        snapshot held;
+        uint64_t seen = 0;
+    };
+
+private:
+    Classifier model;               // the writer's copy
+    std::mutex writer;
+    snapshot published;             // accessed with std::atomic_load/store
+    std::atomic<uint64_t> versions{0};
+
+    // Copy the model into a new snapshot, sharing its arrays, and make it
+    // the current one.  The version is bumped after the store, so a reader
+    // that sees the new version also gets the new snapshot.
+    void publish() {
+        model.share_counts();
+        snapshot next = std::make_shared<const Classifier>(model);
+        std::atomic_store(&published, std::move(next));
+        versions.fetch_add(1, std::memory_order_release);
+    }
+};
+
+#endif
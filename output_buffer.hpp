@@ -0,0 +1,69 @@
+#ifndef OUTPUT_BUFFER_HPP
+#define OUTPUT_BUFFER_HPP
+/* output_buffer.hpp
+ *
+ * Large write buffer for a stream that goes to a file descriptor.  While an
+ * output_buffer is alive, everything written to its stream collects in one
+ * reusable buffer that is written out with write(2) a block at a time,
+ * instead of through the stream's small default buffer.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+#include <unistd.h>
+
+class output_buffer : public std::streambuf {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1 << 20;
+
+    // Redirect os to fd through a buffer of the given size
+    output_buffer(std::ostream &os, int fd, size_t capacity = DEFAULT_CAPACITY)
+        : os(os), fd(fd), buffer(capacity) {
+        os.flush();
+        setp(buffer.data(), buffer.data() + buffer.size());
+        previous = os.rdbuf(this);
+    }
+
+    // Write what is left and give os its own buffer back
+    ~output_buffer() {
+        sync();
+        os.rdbuf(previous);
+    }
+
+    output_buffer(const output_buffer &) = delete;
+    output_buffer & operator= (const output_buffer &) = delete;
+
+protected:
+    int_type overflow(int_type c) override {
+        if (sync() != 0) return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    // Write out the buffer.  Returns -1 if the descriptor fails.
+    int sync() override {
+        const char *p = pbase();
+        while (p < pptr()) {
+            ssize_t n = ::write(fd, p, size_t(pptr() - p));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return -1;
+            p += n;
+        }
+        setp(buffer.data(), buffer.data() + buffer.size());
+        return 0;
+    }
+
+private:
+    std::ostream &os;
+    int fd;
+    std::vector<char> buffer;
+    std::streambuf *previous;
+};
+
+#endif
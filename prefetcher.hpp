@@ -0,0 +1,87 @@
+#ifndef PREFETCHER_HPP
+#define PREFETCHER_HPP
+/* prefetcher.hpp
+ *
+ * Background prefetch for a memory-mapped file that is read front to back.
+ * A thread faults the mapping in a block at a time, staying up to
+ * BLOCKS_AHEAD blocks in front of the reader, so disk reads and page-table
+ * setup happen while the reader is busy parsing the blocks before them.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class prefetcher {
+public:
+    static constexpr size_t BLOCK = size_t(1) << 20;
+    static constexpr size_t BLOCKS_AHEAD = 4;
+
+    // Start prefetching the size bytes at base, which must stay mapped for
+    // the life of this object
+    prefetcher(const char *base, size_t size)
+        : base(base), size(size), worker([this]() { run(); }) {}
+
+    ~prefetcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        moved.notify_one();
+        worker.join();
+    }
+
+    prefetcher(const prefetcher &) = delete;
+    prefetcher & operator= (const prefetcher &) = delete;
+
+    // The reader has reached offset pos.  Cheap unless pos is in a new block.
+    void advance(size_t pos) {
+        size_t block = pos / BLOCK;
+        if (block == last_block) return;
+        last_block = block;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reader_block = block;
+        }
+        moved.notify_one();
+    }
+
+private:
+    const char *base;
+    size_t size;
+    size_t last_block = 0;      // reader's block, seen by the reader only
+    size_t reader_block = 0;    // reader's block, guarded by mutex
+    bool stopped = false;
+    std::mutex mutex;
+    std::condition_variable moved;
+    std::thread worker;
+
+    void run() {
+        for (size_t block = 0; block * BLOCK < size; ++block) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                moved.wait(lock, [&] {
+                    return stopped || block < reader_block + BLOCKS_AHEAD;
+                });
+                if (stopped) return;
+            }
+            fault_in(block * BLOCK, std::min(size, (block + 1) * BLOCK));
+        }
+    }
+
+    // Ask the kernel to read [begin, end), then touch every page of it
+    void fault_in(size_t begin, size_t end) {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        madvise(const_cast<char *>(base + begin), end - begin, MADV_WILLNEED);
+        const volatile char *bytes = base;
+        for (size_t i = begin; i < end; i += page) {
+            (void)bytes[i];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef RUN_STATS_HPP
+#define RUN_STATS_HPP
+/* run_stats.hpp
+ *
+ * Counters and scoped timers for the classifier's hot paths, reported by
+ * --stats and --stats-json.  Nothing is recorded until enable() is called:
+ * until then a counter or timer costs one test of a flag, and no clock is
+ * read.  Once enabled, each thread adds to counters of its own, which are
+ * merged into the totals when the thread exits, so any thread may record
+ * without sharing a cache line.  Timers add the time spent inside their
+ * scope; for stages that run on several threads at once the total is
+ * thread time, not wall time.
+ *
+ * Build with -DCLASSIFIER_STATS=0 to compile every counter and timer out.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+
+#ifndef CLASSIFIER_STATS
+#define CLASSIFIER_STATS 1
+#endif
+
+enum stat_counter {
+    ROWS_PARSED,        // CSV rows read
+    BYTES_READ,         // bytes of tag and content fields read
+    WORDS_TOKENIZED,    // whitespace-delimited words, duplicates included
+    LOOKUPS_AVOIDED,    // duplicate words dropped before any model lookup
+    PREDICTIONS,        // posts scored
+    NUM_STAT_COUNTERS
+};
+
+enum stat_timer {
+    PARSE_TIME,         // reading CSV rows
+    TOKENIZE_TIME,      // splitting posts into unique words
+    TRAIN_TIME,         // building the counts, including parse and tokenize
+    COMPILE_TIME,       // building the log-likelihood table
+    PREDICT_TIME,       // the test file, including parse, tokenize and output
+    SCORE_TIME,         // Classifier::predict alone
+    FORMAT_TIME,        // formatting numbers for output
+    NUM_STAT_TIMERS
+};
+
+class run_stats {
+public:
+    // Start recording, before any thread that records is started
+    static void enable(bool on = true) {
+        enabled.store(on, std::memory_order_relaxed);
+    }
+
+    static bool is_enabled() {
+        return CLASSIFIER_STATS && enabled.load(std::memory_order_relaxed);
+    }
+
+    static void count(stat_counter c, uint64_t n = 1) {
+#if CLASSIFIER_STATS
+        if (is_enabled()) local().counters[c] += n;
+#else
+        (void)c; (void)n;
+#endif
+    }
+
+    // Adds the time between construction and destruction to a timer
+    class scoped_timer {
+    public:
+#if CLASSIFIER_STATS
+        explicit scoped_timer(stat_timer t) : timer(t), on(is_enabled()) {
+            if (on) start = std::chrono::steady_clock::now();
+        }
+        ~scoped_timer() {
+            if (!on) return;
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            local().timers[timer] += uint64_t(ns);
+        }
+#else
+        explicit scoped_timer(stat_timer) {}
+#endif
+        scoped_timer(const scoped_timer &) = delete;
+        scoped_timer & operator= (const scoped_timer &) = delete;
+
+#if CLASSIFIER_STATS
+    private:
+        stat_timer timer;
+        bool on;
+        std::chrono::steady_clock::time_point start;
+#endif
+    };
+
+    // Per-stage breakdown for people, of the threads that have exited and
+    // the calling thread
+    static void print(std::ostream &os) {
+        if (!CLASSIFIER_STATS) {
+            os << "stats: not compiled in (CLASSIFIER_STATS=0)\n";
+            return;
+        }
+        local().merge();
+        std::ios init(nullptr);
+        init.copyfmt(os);
+        os << std::fixed << std::setprecision(3) << "stats:\n";
+        for (int t = 0; t < NUM_STAT_TIMERS; ++t) {
+            os << "  " << std::left << std::setw(20) << TIMER_NAMES[t] << std::right
+               << std::setw(12) << seconds(stat_timer(t)) << " s\n";
+        }
+        for (int c = 0; c < NUM_STAT_COUNTERS; ++c) {
+            os << "  " << std::left << std::setw(20) << COUNTER_NAMES[c] << std::right
+               << std::setw(12) << get(stat_counter(c)) << "\n";
+        }
+        os << "  " << std::left << std::setw(20) << "parse_mb_per_sec" << std::right
+           << std::setw(12) << rate(BYTES_READ, PARSE_TIME) / 1e6 << "\n"
+           << "  " << std::left << std::setw(20) << "predictions_per_sec" << std::right
+           << std::setw(12) << rate(PREDICTIONS, PREDICT_TIME) << "\n";
+        os.copyfmt(init);
+    }
+
+    // The same data as one JSON object
+    static void print_json(std::ostream &os) {
+        local().merge();
+        std::ios init(nullptr);
+        init.copyfmt(os);
+        os << std::setprecision(9)
+           << "{\"enabled\": " << (CLASSIFIER_STATS ? "true" : "false")
+           << ", \"seconds\": {";
+        for (int t = 0; t < NUM_STAT_TIMERS; ++t) {
+            os << (t ? ", " : "") << '"' << TIMER_NAMES[t] << "\": "
+               << seconds(stat_timer(t));
+        }
+        os << "}, \"counters\": {";
+        for (int c = 0; c < NUM_STAT_COUNTERS; ++c) {
+            os << (c ? ", " : "") << '"' << COUNTER_NAMES[c] << "\": "
+               << get(stat_counter(c));
+        }
+        os << "}, \"parse_bytes_per_sec\": " << rate(BYTES_READ, PARSE_TIME)
+           << ", \"predictions_per_sec\": " << rate(PREDICTIONS, PREDICT_TIME) << "}\n";
+        os.copyfmt(init);
+    }
+
+private:
+    static constexpr const char *COUNTER_NAMES[NUM_STAT_COUNTERS] = {
+        "rows_parsed", "bytes_read", "words_tokenized", "lookups_avoided",
+        "predictions"};
+    static constexpr const char *TIMER_NAMES[NUM_STAT_TIMERS] = {
+        "parse", "tokenize", "train", "compile", "predict", "score", "format"};
+
+    static inline std::atomic<bool> enabled{false};
+    static inline std::atomic<uint64_t> counters[NUM_STAT_COUNTERS] = {};
+    static inline std::atomic<uint64_t> timers[NUM_STAT_TIMERS] = {};  // ns
+
+    // One thread's counts since its last merge
+    struct thread_stats {
+        uint64_t counters[NUM_STAT_COUNTERS] = {};
+        uint64_t timers[NUM_STAT_TIMERS] = {};
+
+        ~thread_stats() { merge(); }
+
+        // Add to the totals and start again from zero
+        void merge() {
+            for (int c = 0; c < NUM_STAT_COUNTERS; ++c) {
+                run_stats::counters[c].fetch_add(counters[c], std::memory_order_relaxed);
+                counters[c] = 0;
+            }
+            for (int t = 0; t < NUM_STAT_TIMERS; ++t) {
+                run_stats::timers[t].fetch_add(timers[t], std::memory_order_relaxed);
+                timers[t] = 0;
+            }
+        }
+    };
+
+    static thread_stats & local() {
+        thread_local thread_stats stats;
+        return stats;
+    }
+
+    static uint64_t get(stat_counter c) {
+        return counters[c].load(std::memory_order_relaxed);
+    }
+    static double seconds(stat_timer t) {
+        return double(timers[t].load(std::memory_order_relaxed)) / 1e9;
+    }
+    // Counter per second of a timer, or 0 if the timer never ran
+    static double rate(stat_counter c, stat_timer t) {
+        double s = seconds(t);
+        return s > 0.0 ? double(get(c)) / s : 0.0;
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <cstdlib>
+#include "csvmmap.hpp"
+#include "classifier.hpp"
+#include "model_snapshots.hpp"
+
+using namespace std;
+
+/*
+ * Stress test and benchmark for model_snapshots.
+ *
+ * Trains a model on the first half of TRAIN_CSV, then has one writer count
+ * the rest in --batches batches, publishing a snapshot after each, while
+ * --readers threads predict the posts of TEST_CSV (TRAIN_CSV if there is
+ * none) from the newest snapshot.
+ *   1) Checks every prediction, label and score, against a model compiled
+ *      from scratch on the posts up to the same batch as the snapshot it
+ *      came from, and that no reader ever sees an older snapshot after a
+ *      newer one.
+ *   2) Reports read latency percentiles with no writer and under write
+ *      load, and the time to apply and publish a batch.
+ * Exits with status 1 if any check fails.
+ */
+
+// Wall time of the reads measured with no writer
+const double IDLE_SECONDS = 0.2;
+
+// Posts read from the test file, at most this many
+const size_t MAX_PROBES = 500;
+
+struct Post {
+    string label;
+    string content;
+};
+
+static vector<Post> read_posts(const string &filename) {
+    csvmmap csv(filename, POST_COLUMNS);
+    vector<Post> posts;
+    csvrow_view row;
+    while (csv >> row) {
+        posts.push_back({string(row[TAG]), string(row[CONTENT])});
+    }
+    return posts;
+}
+
+// What a reader measured and found wrong
+struct ReadLog {
+    vector<double> latencies;   // seconds per prediction
+    size_t mismatches = 0;      // predictions unlike their snapshot's
+    size_t unknown = 0;         // snapshots of no batch boundary
+    size_t regressions = 0;     // snapshots older than one seen before
+};
+
+static void print_latencies(const string &name, vector<double> latencies) {
+    sort(latencies.begin(), latencies.end());
+    cout << "  " << left << setw(14) << name << right << setw(10) << latencies.size()
+         << " reads";
+    if (!latencies.empty()) {
+        const pair<const char *, double> points[] = {
+            {"p50", 0.50}, {"p90", 0.90}, {"p99", 0.99}, {"max", 1.0}};
+        for (const auto &point : points) {
+            size_t i = size_t(point.second * double(latencies.size() - 1));
+            cout << ", " << point.first << " = " << latencies[i] * 1e6 << " us";
+        }
+    }
+    cout << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    size_t readers = 4;
+    size_t batches = 50;
+    int i = 1;
+    for (; i + 1 < argc && string(argv[i]).rfind("--", 0) == 0; i += 2) {
+        string flag = argv[i];
+        if (flag == "--readers") readers = strtoul(argv[i + 1], nullptr, 10);
+        else if (flag == "--batches") batches = strtoul(argv[i + 1], nullptr, 10);
+        else i = argc;
+    }
+    if (i >= argc || i + 2 < argc || readers == 0 || batches == 0) {
+        cout << "Usage: snapshot_bench.exe [--readers N] [--batches B] "
+             << "TRAIN_CSV [TEST_CSV]" << endl;
+        return 1;
+    }
+    cout << fixed << setprecision(1);
+
+    vector<Post> train, probes;
+    try {
+        train = read_posts(argv[i]);
+        probes = read_posts(argv[i + 1 < argc ? i + 1 : i]);
+    }
+    catch (const csvstream_exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    probes.resize(min(probes.size(), MAX_PROBES));
+    vector<vector<string_view>> probe_words;
+    for (const Post &post : probes) {
+        const vector<string_view> &words = unique_words(post.content);
+        probe_words.emplace_back(words.begin(), words.end());
+    }
+
+    // Batch b is posts begin[b] to begin[b + 1]; batch 0 is the initial model
+    size_t initial = max<size_t>(train.size() / 2, 1);
+    batches = min(batches, train.size() - initial);
+    vector<size_t> begin = {0, initial};
+    for (size_t b = 1; b <= batches; ++b) {
+        begin.push_back(initial + b * (train.size() - initial) / batches);
+    }
+
+    // Expected predictions after each batch, by number of posts counted
+    Classifier reference;
+    map<int, size_t> batch_of_posts;
+    vector<vector<pair<string, double>>> expected;
+    for (size_t b = 0; b + 1 < begin.size(); ++b) {
+        reference = Classifier();
+        for (size_t p = 0; p < begin[b + 1]; ++p) {
+            reference.add_post(train[p].label, train[p].content);
+        }
+        reference.compile();
+        batch_of_posts[reference.num_posts()] = b;
+        expected.emplace_back();
+        for (const auto &words : probe_words) {
+            expected.back().push_back(reference.predict(words));
+        }
+    }
+
+    Classifier initial_model;
+    for (size_t p = 0; p < initial; ++p) {
+        initial_model.add_post(train[p].label, train[p].content);
+    }
+    initial_model.compile();
+    model_snapshots snapshots(initial_model);
+
+    // Readers predict the probes round and round until stop is set
+    atomic<bool> stop(false);
+    auto read = [&](ReadLog &log, size_t offset) {
+        using clock = chrono::steady_clock;
+        model_snapshots::reader reader(snapshots);
+        size_t last_batch = 0;
+        for (size_t n = offset; !stop; ++n) {
+            size_t probe = n % probes.size();
+            auto start = clock::now();
+            const Classifier &nb = reader.model();
+            pair<string, double> prediction = nb.predict(probe_words[probe]);
+            log.latencies.push_back(chrono::duration<double>(clock::now() - start).count());
+
+            auto batch = batch_of_posts.find(nb.num_posts());
+            if (batch == batch_of_posts.end()) {
+                ++log.unknown;
+                continue;
+            }
+            log.regressions += batch->second < last_batch;
+            last_batch = batch->second;
+            log.mismatches += prediction != expected[batch->second][probe];
+        }
+    };
+    auto run_readers = [&](vector<ReadLog> &logs, auto &&during) {
+        logs.assign(readers, ReadLog());
+        stop = false;
+        vector<thread> threads;
+        for (size_t r = 0; r < readers; ++r) {
+            threads.emplace_back(read, ref(logs[r]), r * probes.size() / readers);
+        }
+        during();
+        stop = true;
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    };
+
+    // 1) Readers alone
+    vector<ReadLog> idle;
+    run_readers(idle, [] { this_thread::sleep_for(chrono::duration<double>(IDLE_SECONDS)); });
+
+    // 2) Readers while the writer publishes every batch
+    vector<ReadLog> loaded;
+    vector<double> publish_seconds;
+    run_readers(loaded, [&] {
+        for (size_t b = 1; b + 1 < begin.size(); ++b) {
+            auto start = chrono::steady_clock::now();
+            snapshots.update([&](Classifier &nb) {
+                for (size_t p = begin[b]; p < begin[b + 1]; ++p) {
+                    nb.add_post(train[p].label, train[p].content);
+                }
+            });
+            publish_seconds.push_back(
+                chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        }
+    });
+
+    // The last snapshot is the last batch
+    const Classifier &last = *snapshots.current();
+    size_t wrong = last.num_posts() != reference.num_posts();
+    vector<double> idle_latencies, loaded_latencies;
+    for (const auto *logs : {&idle, &loaded}) {
+        for (const ReadLog &log : *logs) {
+            wrong += log.mismatches + log.unknown + log.regressions;
+            auto &all = logs == &idle ? idle_latencies : loaded_latencies;
+            all.insert(all.end(), log.latencies.begin(), log.latencies.end());
+        }
+    }
+
+    cout << argv[i] << ": " << readers << (readers == 1 ? " reader, " : " readers, ")
+         << batches << " batches of " << (train.size() - initial) / batches
+         << " posts, " << probes.size() << " probe posts: "
+         << (wrong ? "MISMATCH" : "predictions identical") << "\n";
+    print_latencies("no writer", idle_latencies);
+    print_latencies("under writes", loaded_latencies);
+    sort(publish_seconds.begin(), publish_seconds.end());
+    if (!publish_seconds.empty()) {
+        cout << "  update + publish p50 = "
+             << publish_seconds[publish_seconds.size() / 2] * 1e3 << " ms, max = "
+             << publish_seconds.back() * 1e3 << " ms\n";
+    }
+    return wrong ? 1 : 0;
+}
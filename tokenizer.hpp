@@ -0,0 +1,107 @@
+#ifndef TOKENIZER_HPP
+#define TOKENIZER_HPP
+/* tokenizer.hpp
+ *
+ * Splits a post into its distinct whitespace-delimited words.  Words are
+ * views into the post, deduplicated through an open-addressing hash set that
+ * is reused from one post to the next, so once the buffers have grown to the
+ * largest post seen, tokenizing allocates nothing.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+class tokenizer {
+public:
+    tokenizer() : slot_word(MIN_SLOTS), slot_stamp(MIN_SLOTS, 0) {}
+
+    // Return the distinct words of text in sorted order, the same words
+    // reading text with operator>> into a std::set<std::string> gives.  The
+    // views point into text and the vector is reused by the next call.
+    const std::vector<std::string_view> & unique_words(std::string_view text) {
+        words.clear();
+        tokens = 0;
+        next_stamp();
+
+        const char *p = text.data();
+        const char *end = p + text.size();
+        while (true) {
+            while (p < end && is_space(*p)) ++p;
+            if (p == end) break;
+            const char *begin = p;
+            while (p < end && !is_space(*p)) ++p;
+            insert(std::string_view(begin, size_t(p - begin)));
+            ++tokens;
+        }
+
+        std::sort(words.begin(), words.end());
+        return words;
+    }
+
+    // Number of words in the last text, duplicates included
+    size_t token_count() const {
+        return tokens;
+    }
+
+private:
+    static constexpr size_t MIN_SLOTS = 64;
+
+    std::vector<std::string_view> words;  // distinct words of the current post
+    std::vector<uint32_t> slot_word;      // hash table of indices into words
+    std::vector<uint32_t> slot_stamp;     // slot is in use if it equals stamp
+    uint32_t stamp = 0;
+    size_t tokens = 0;
+
+    // Whitespace as in the "C" locale, which operator>> uses by default
+    static bool is_space(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    // FNV-1a
+    static uint32_t hash(std::string_view s) {
+        uint32_t h = 2166136261u;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    // Empty the hash set without touching every slot
+    void next_stamp() {
+        if (++stamp == 0) {
+            std::fill(slot_stamp.begin(), slot_stamp.end(), 0);
+            stamp = 1;
+        }
+    }
+
+    // Add w to words unless it is already there
+    void insert(std::string_view w) {
+        size_t mask = slot_word.size() - 1;
+        size_t i = hash(w) & mask;
+        for (; slot_stamp[i] == stamp; i = (i + 1) & mask) {
+            if (words[slot_word[i]] == w) return;
+        }
+        slot_word[i] = static_cast<uint32_t>(words.size());
+        slot_stamp[i] = stamp;
+        words.push_back(w);
+        if (2 * words.size() > slot_word.size()) grow();
+    }
+
+    // Double the table, keeping the load factor at or below 1/2
+    void grow() {
+        slot_word.resize(slot_word.size() * 2);
+        slot_stamp.assign(slot_word.size(), 0);
+        size_t mask = slot_word.size() - 1;
+        for (uint32_t id = 0; id < words.size(); ++id) {
+            size_t i = hash(words[id]) & mask;
+            while (slot_stamp[i] == stamp) i = (i + 1) & mask;
+            slot_word[i] = id;
+            slot_stamp[i] = stamp;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef WORK_QUEUE_HPP
+#define WORK_QUEUE_HPP
+/* work_queue.hpp
+ *
+ * Bounded multi-producer, multi-consumer queue for handing work between
+ * pipeline stages.  push() blocks while the queue is full, so a fast
+ * producer cannot run arbitrarily far ahead of its consumers.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class work_queue {
+public:
+    explicit work_queue(size_t capacity) : capacity(capacity) {}
+
+    // Add an item, waiting for room.  Returns false if the queue was closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Remove the oldest item, waiting for one.  Returns false once the queue
+    // is closed and empty.
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed.  Consumers drain what is left.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+};
+
+#endif